@@ -0,0 +1,168 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Fleet transition benchmark.
+ *
+ * A fleet of identical HSMs sits in a deep state.  An EV_RELOAD moves every
+ * one of them across the hierarchy to another deep state, with a transition
+ * action, and the next EV_RELOAD moves them back.  We time sending each
+ * EV_RELOAD to the whole fleet three ways: sendEvent() on each HSM in turn,
+ * one CTHsm::cthsmBulkSend(), and a Fleet using every core.
+ *
+ * Usage: fleet [machines [reloads]]
+ */
+
+#include "cthsm_fleet.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace CTHSM;
+
+typedef std::chrono::steady_clock Clock;
+
+
+class ReloadEvent : public Event {
+public:
+	ReloadEvent(int n) : Event(n) { };
+	enum {
+		EV_RELOAD = CTHE_USER,
+	};
+};
+
+
+/**
+ * top - running - serving - active - busy
+ *             \- draining - reloading - applying
+ *
+ * EV_RELOAD moves busy to applying, and applying back to busy.
+ */
+class Server : public CTHsm<Server, ReloadEvent> {
+public:
+	Server() : CTHsm<Server,ReloadEvent>(&Server::busy), actions(0),
+		   reloads(0)
+	{
+		cthsmRegister(&Server::applying);
+		cthsmStart();
+	};
+
+	CTHsmState running(ReloadEvent e) {
+		return step(e, &Server::topState);
+	};
+	CTHsmState serving(ReloadEvent e) {
+		return step(e, &Server::running);
+	};
+	CTHsmState active(ReloadEvent e) {
+		return step(e, &Server::serving);
+	};
+	CTHsmState busy(ReloadEvent e) {
+		if (e.event() == ReloadEvent::EV_RELOAD)
+			return cth_transition(&Server::applying,
+					      &Server::reload);
+		return step(e, &Server::active);
+	};
+	CTHsmState draining(ReloadEvent e) {
+		return step(e, &Server::running);
+	};
+	CTHsmState reloading(ReloadEvent e) {
+		return step(e, &Server::draining);
+	};
+	CTHsmState applying(ReloadEvent e) {
+		if (e.event() == ReloadEvent::EV_RELOAD)
+			return cth_transition(&Server::busy, &Server::reload);
+		return step(e, &Server::reloading);
+	};
+
+	void reload() {
+		reloads++;
+	};
+
+	unsigned long actions;
+	unsigned long reloads;
+
+private:
+	/** Count entries and exits, and pass everything else up. */
+	CTHsmState step(ReloadEvent e, State parent) {
+		switch (e.event()) {
+		case ReloadEvent::CTHE_ENTRY:
+		case ReloadEvent::CTHE_EXIT:
+			actions++;
+			return cth_handled();
+		default:
+			return cth_parent(parent);
+		}
+	};
+};
+
+
+static double measure(std::vector<Server*>& fleet, unsigned reloads,
+		   Fleet<Server, ReloadEvent>* parallel, bool bulk)
+{
+	ReloadEvent e(ReloadEvent::EV_RELOAD);
+	Clock::time_point start = Clock::now();
+	for (unsigned r = 0; r < reloads; r++) {
+		if (parallel) {
+			parallel->sendEvent(fleet, e);
+		} else if (bulk) {
+			Server::cthsmBulkSend(&fleet[0], fleet.size(), e);
+		} else {
+			for (unsigned i = 0; i < fleet.size(); i++)
+				fleet[i]->sendEvent(e);
+		}
+	}
+	return std::chrono::duration<double>(
+		Clock::now() - start).count();
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned long machines = 100000;
+	unsigned reloads = 20;
+	if (argc > 1)
+		machines = strtoul(argv[1], 0, 0);
+	if (argc > 2)
+		reloads = strtoul(argv[2], 0, 0);
+	if (! machines)
+		machines = 1;
+
+	std::vector<Server*> fleet;
+	for (unsigned long i = 0; i < machines; i++)
+		fleet.push_back(new Server);
+
+	unsigned cores = std::thread::hardware_concurrency();
+	Fleet<Server, ReloadEvent> parallel(cores > 1 ? cores - 1 : 0);
+
+	printf("cores: %u, machines: %lu, reloads: %u\n", cores, machines,
+	       reloads);
+	double one = measure(fleet, reloads, 0, false);
+	double bulk = measure(fleet, reloads, 0, true);
+	double par = measure(fleet, reloads, &parallel, true);
+	double n = double(machines) * reloads;
+	printf("sendEvent      %8.3f s %8.1f ns/transition\n", one,
+	       one / n * 1e9);
+	printf("cthsmBulkSend  %8.3f s %8.1f ns/transition\n", bulk,
+	       bulk / n * 1e9);
+	printf("Fleet          %8.3f s %8.1f ns/transition\n", par,
+	       par / n * 1e9);
+
+	for (unsigned long i = 0; i < machines; i++) {
+		if (fleet[i]->reloads != 3 * reloads) {
+			printf("machine %lu did %lu reloads, not %u\n", i,
+			       fleet[i]->reloads, 3 * reloads);
+			return 1;
+		}
+		delete fleet[i];
+	}
+	return 0;
+}
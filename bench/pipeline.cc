@@ -0,0 +1,188 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Pipeline benchmark for SpscChannel.
+ *
+ * A source thread feeds a chain of HSMs, each on its own thread pinned to
+ * its own core, connected by SpscChannels.  Each HSM forwards every item
+ * to the next.  We report the throughput of the whole pipeline and the
+ * mean latency of each hop (from the push by one stage to the handling by
+ * the next.)  When the source is faster than the pipeline, the latency
+ * includes the time items spend queued in the channels.
+ *
+ * Usage: pipeline [items [minstages [maxstages]]]
+ */
+
+#include "cthsm_channel.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+using namespace CTHSM;
+
+typedef std::chrono::steady_clock Clock;
+
+static long long nanos()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		Clock::now().time_since_epoch()).count();
+}
+
+
+class PipeEvent : public Event {
+public:
+	PipeEvent(int n) : Event(n), seq(0), stamp(0) { };
+	PipeEvent(int n, unsigned long seq)
+		: Event(n), seq(seq), stamp(0) { };
+	enum {
+		EV_ITEM = CTHE_USER,
+	};
+	unsigned long seq;
+	/** When this item was pushed into the channel it came from. */
+	long long stamp;
+};
+
+typedef SpscChannel<PipeEvent> Channel;
+
+
+/**
+ * One stage of the pipeline.  Forwards each item to the next stage, if
+ * there is one.
+ */
+class Stage : public CTHsm<Stage, PipeEvent> {
+public:
+	Stage(Channel* out) : CTHsm<Stage,PipeEvent>(&Stage::forwarding),
+			      out(out), received(0), latency(0)
+	{
+		cthsmStart();
+	};
+
+	CTHsmState forwarding(PipeEvent e) {
+		switch (e.event()) {
+		case PipeEvent::EV_ITEM: {
+			long long now = nanos();
+			latency += now - e.stamp;
+			received++;
+			if (out) {
+				e.stamp = now;
+				while (! out->push(e))
+					std::this_thread::yield();
+			}
+			return cth_handled();
+		}
+		default:
+			return cth_parent(&Stage::topState);
+		}
+	};
+
+	Channel* out;
+	unsigned long received;
+	long long latency;
+};
+
+
+static void pin(std::thread& t, unsigned core)
+{
+	unsigned ncpus = std::thread::hardware_concurrency();
+	if (! ncpus)
+		return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core % ncpus, &set);
+	pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+}
+
+
+static void run(unsigned nstages, unsigned long items)
+{
+	std::vector<Channel*> channels;
+	for (unsigned i = 0; i < nstages; i++)
+		channels.push_back(new Channel);
+
+	std::vector<Stage*> stages;
+	for (unsigned i = 0; i < nstages; i++) {
+		Channel* out = (i + 1 < nstages) ? channels[i + 1] : 0;
+		stages.push_back(new Stage(out));
+	}
+
+	long long start = nanos();
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < nstages; i++) {
+		threads.push_back(std::thread([&, i]() {
+			ChannelInbox<Stage, PipeEvent> inbox(stages[i]);
+			inbox.add(channels[i]);
+			Channel* out = stages[i]->out;
+			while (stages[i]->received < items) {
+				unsigned n = inbox.poll();
+				if (out)
+					out->flush();
+				if (! n)
+					std::this_thread::yield();
+			}
+		}));
+		pin(threads.back(), i + 1);
+	}
+
+	std::thread source([&]() {
+		Channel* c = channels[0];
+		for (unsigned long i = 0; i < items; i++) {
+			PipeEvent e(PipeEvent::EV_ITEM, i);
+			e.stamp = nanos();
+			while (! c->push(e))
+				std::this_thread::yield();
+		}
+		c->flush();
+	});
+	pin(source, 0);
+
+	source.join();
+	for (unsigned i = 0; i < nstages; i++)
+		threads[i].join();
+	long long elapsed = nanos() - start;
+
+	printf("%u stages: %lu items in %.3f s, %.2f Mitems/s\n", nstages,
+	       items, elapsed / 1e9, items * 1e3 / elapsed);
+	printf("  per-hop latency (ns):");
+	for (unsigned i = 0; i < nstages; i++)
+		printf(" %.0f", double(stages[i]->latency) / items);
+	printf("\n");
+
+	for (unsigned i = 0; i < nstages; i++) {
+		delete stages[i];
+		delete channels[i];
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned long items = 2000000;
+	unsigned minstages = 2;
+	unsigned maxstages = 8;
+	if (argc > 1)
+		items = strtoul(argv[1], 0, 0);
+	if (argc > 2)
+		minstages = maxstages = strtoul(argv[2], 0, 0);
+	if (argc > 3)
+		maxstages = strtoul(argv[3], 0, 0);
+
+	if (! minstages)
+		minstages = 1;
+
+	printf("cores: %u\n", std::thread::hardware_concurrency());
+	for (unsigned n = minstages; n <= maxstages; n *= 2)
+		run(n, items);
+	return 0;
+}
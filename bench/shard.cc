@@ -0,0 +1,136 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Scaling benchmark for ShardedRuntime.
+ *
+ * Many independent HSMs, like one per connection, each handle a stream of
+ * events.  In the "local" run each HSM sends every event on to itself, so
+ * no event leaves its shard.  In the "remote" run each HSM sends to another
+ * key, so most events cross to another shard through a channel.  We report
+ * the total event rate for each number of shards; independent machines
+ * should scale with the number of cores.
+ *
+ * Usage: shard [machines [events [maxshards]]]
+ */
+
+#include "cthsm_shard.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace CTHSM;
+
+typedef std::chrono::steady_clock Clock;
+
+
+class WorkEvent : public Event {
+public:
+	WorkEvent(int n) : Event(n), left(0) { };
+	WorkEvent(int n, unsigned long left) : Event(n), left(left) { };
+	enum {
+		EV_WORK = CTHE_USER,
+	};
+	unsigned long left;
+};
+
+
+class Worker;
+typedef ShardedRuntime<Worker, WorkEvent> Runtime;
+
+static Runtime* runtime;
+static unsigned long machines;
+static bool remote;
+static std::atomic<unsigned long> finished;
+
+
+/**
+ * Does a little work for each event, and passes the event on until it has
+ * been passed on enough times.
+ */
+class Worker : public CTHsm<Worker, WorkEvent> {
+public:
+	Worker(unsigned long key) : CTHsm<Worker,WorkEvent>(&Worker::working),
+				    key(key), sum(0)
+	{
+		cthsmStart();
+		cthsmSetBudget(16);
+	};
+
+	CTHsmState working(WorkEvent e) {
+		switch (e.event()) {
+		case WorkEvent::EV_WORK:
+			sum = sum * 31 + e.left;
+			if (! e.left) {
+				finished.fetch_add(1, std::memory_order_relaxed);
+				return cth_handled();
+			}
+			runtime->send(remote ? (key + 1) % machines : key,
+				      WorkEvent(WorkEvent::EV_WORK, e.left - 1));
+			return cth_handled();
+		default:
+			return cth_parent(&Worker::topState);
+		}
+	};
+
+	unsigned long key;
+	unsigned long sum;
+};
+
+
+static void run(unsigned nshards, unsigned long events)
+{
+	Runtime r(nshards, Runtime::Factory(), true);
+	runtime = &r;
+	finished = 0;
+	r.start();
+
+	Clock::time_point start = Clock::now();
+	for (unsigned long k = 0; k < machines; k++)
+		r.send(k, WorkEvent(WorkEvent::EV_WORK, events - 1));
+	r.flush();
+	while (finished.load(std::memory_order_relaxed) < machines)
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	double elapsed = std::chrono::duration<double>(
+		Clock::now() - start).count();
+	r.stop();
+
+	printf("%-6s %2u shards: %.3f s, %7.2f Mevents/s\n",
+	       remote ? "remote" : "local", nshards, elapsed,
+	       machines * double(events) / elapsed / 1e6);
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned long events = 2000;
+	unsigned maxshards = std::thread::hardware_concurrency();
+	machines = 10000;
+	if (argc > 1)
+		machines = strtoul(argv[1], 0, 0);
+	if (argc > 2)
+		events = strtoul(argv[2], 0, 0);
+	if (argc > 3)
+		maxshards = strtoul(argv[3], 0, 0);
+	if (! maxshards)
+		maxshards = 1;
+	if (! events)
+		events = 1;
+
+	printf("cores: %u\n", std::thread::hardware_concurrency());
+	for (int i = 0; i < 2; i++) {
+		remote = i;
+		for (unsigned n = 1; n <= maxshards; n *= 2)
+			run(n, events);
+	}
+	return 0;
+}
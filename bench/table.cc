@@ -0,0 +1,255 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Table driven HSM benchmark.
+ *
+ * The Server machine from the fleet benchmark, compiled as a CTHsm and as
+ * a TableHsm.  EV_RELOAD moves it across the hierarchy between two deep
+ * states, and EV_PING is handled by the top state, so we time both long
+ * transitions and events that CTHsm has to pass up through every parent.
+ *
+ * Then we time loading, and checking, a large table from a file.
+ *
+ * Usage: table [events [states]]
+ */
+
+#include "cthsm.hh"
+#include "cthsm_table.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace CTHSM;
+
+typedef std::chrono::steady_clock Clock;
+
+
+static double since(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+class ServerEvent : public Event {
+public:
+	ServerEvent(int n) : Event(n) { };
+	enum {
+		EV_RELOAD = CTHE_USER,
+		EV_PING,
+	};
+};
+
+
+/**
+ * top - running - serving - active - busy
+ *             \- draining - reloading - applying
+ */
+class Server : public CTHsm<Server, ServerEvent> {
+public:
+	Server() : CTHsm<Server,ServerEvent>(&Server::busy), actions(0),
+		   pings(0)
+	{
+		cthsmRegister(&Server::applying);
+		cthsmStart();
+	};
+
+	CTHsmState topState(ServerEvent e) {
+		if (e.event() == ServerEvent::EV_PING) {
+			pings++;
+			return cth_handled();
+		}
+		return CTHsm<Server,ServerEvent>::topState(e);
+	};
+	CTHsmState running(ServerEvent e) {
+		return step(e, &Server::topState);
+	};
+	CTHsmState serving(ServerEvent e) {
+		return step(e, &Server::running);
+	};
+	CTHsmState active(ServerEvent e) {
+		return step(e, &Server::serving);
+	};
+	CTHsmState busy(ServerEvent e) {
+		if (e.event() == ServerEvent::EV_RELOAD)
+			return cth_transition(&Server::applying);
+		return step(e, &Server::active);
+	};
+	CTHsmState draining(ServerEvent e) {
+		return step(e, &Server::running);
+	};
+	CTHsmState reloading(ServerEvent e) {
+		return step(e, &Server::draining);
+	};
+	CTHsmState applying(ServerEvent e) {
+		if (e.event() == ServerEvent::EV_RELOAD)
+			return cth_transition(&Server::busy);
+		return step(e, &Server::reloading);
+	};
+
+	unsigned long actions;
+	unsigned long pings;
+
+private:
+	CTHsmState step(ServerEvent e, State parent) {
+		switch (e.event()) {
+		case ServerEvent::CTHE_ENTRY:
+		case ServerEvent::CTHE_EXIT:
+			actions++;
+			return cth_handled();
+		default:
+			return cth_parent(parent);
+		}
+	};
+};
+
+
+enum { TOP, RUNNING, SERVING, ACTIVE, BUSY, DRAINING, RELOADING, APPLYING };
+enum { EV_RELOAD, EV_PING, EVENTS };
+enum { ACT_STEP, ACT_PING };
+
+struct Counts {
+	unsigned long actions;
+	unsigned long pings;
+};
+
+
+static void count(TableHsm& hsm, uint32_t id)
+{
+	Counts* c = static_cast<Counts*>(hsm.user());
+	if (id == ACT_PING)
+		c->pings++;
+	else
+		c->actions++;
+}
+
+
+static std::string serverTable()
+{
+	TableBuilder b(EVENTS);
+	b.state(TABLE_NONE);
+	b.state(TOP, ACT_STEP, ACT_STEP);
+	b.state(RUNNING, ACT_STEP, ACT_STEP);
+	b.state(SERVING, ACT_STEP, ACT_STEP);
+	b.state(ACTIVE, ACT_STEP, ACT_STEP);
+	b.state(RUNNING, ACT_STEP, ACT_STEP);
+	b.state(DRAINING, ACT_STEP, ACT_STEP);
+	b.state(RELOADING, ACT_STEP, ACT_STEP);
+	b.transition(BUSY, EV_RELOAD, APPLYING);
+	b.transition(APPLYING, EV_RELOAD, BUSY);
+	b.handle(TOP, EV_PING, ACT_PING);
+	b.initial(BUSY);
+	return b.build();
+}
+
+
+/**
+ * A random tree of states, each handling a quarter of the events, a third
+ * of those with a transition to a random state.
+ */
+static const char* writeLargeTable(const char* filename, unsigned nstates,
+				   unsigned nevents)
+{
+	std::mt19937 random(1);
+	TableBuilder b(nevents);
+	b.state(TABLE_NONE, 0, 1);
+	for (unsigned s = 1; s < nstates; s++)
+		b.state(random() % s, 0, 1);
+	for (unsigned s = 0; s < nstates; s++) {
+		for (unsigned e = 0; e < nevents; e++) {
+			unsigned k = random() % 12;
+			if (k < 2)
+				b.handle(s, e, 2);
+			else if (k < 3)
+				b.transition(s, e, 1 + random() % (nstates - 1),
+					     3, 2);
+		}
+	}
+	b.initial(nstates - 1);
+	return b.write(filename);
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned long events = 10000000;
+	unsigned nstates = 2000;
+	if (argc > 1)
+		events = strtoul(argv[1], 0, 0);
+	if (argc > 2)
+		nstates = strtoul(argv[2], 0, 0);
+	if (nstates < 2)
+		nstates = 2;
+
+	Server compiled;
+	Clock::time_point start = Clock::now();
+	for (unsigned long i = 0; i < events; i++)
+		compiled.sendEvent(ServerEvent(i & 1 ? ServerEvent::EV_PING
+					       : ServerEvent::EV_RELOAD));
+	double cthsm = since(start);
+
+	std::string bytes = serverTable();
+	std::vector<uint32_t> aligned(bytes.size() / 4);
+	memcpy(&aligned[0], bytes.data(), bytes.size());
+	StateTable table;
+	const char* error = table.attach(&aligned[0], bytes.size());
+	if (error) {
+		printf("server table: %s\n", error);
+		return 1;
+	}
+	TableActions actions;
+	actions.bind(ACT_STEP, count);
+	actions.bind(ACT_PING, count);
+	Counts counts = { 0, 0 };
+	TableHsm hsm(table, actions, &counts);
+	hsm.start();
+	start = Clock::now();
+	for (unsigned long i = 0; i < events; i++)
+		hsm.sendEvent(i & 1 ? EV_PING : EV_RELOAD);
+	double tab = since(start);
+
+	if (counts.actions != compiled.actions
+	    || counts.pings != compiled.pings) {
+		printf("table did %lu actions and %lu pings, CTHsm did %lu "
+		       "and %lu\n", counts.actions, counts.pings,
+		       compiled.actions, compiled.pings);
+		return 1;
+	}
+	printf("events: %lu\n", events);
+	printf("CTHsm     %8.3f s %8.1f ns/event\n", cthsm,
+	       cthsm / events * 1e9);
+	printf("TableHsm  %8.3f s %8.1f ns/event\n", tab, tab / events * 1e9);
+
+	const char* filename = "table.bin";
+	const unsigned nevents = 64;
+	error = writeLargeTable(filename, nstates, nevents);
+	if (error) {
+		printf("%s: %s\n", filename, error);
+		return 1;
+	}
+	const unsigned loads = 20;
+	start = Clock::now();
+	for (unsigned i = 0; i < loads; i++) {
+		StateTable large;
+		error = large.load(filename);
+		if (error) {
+			printf("%s: %s\n", filename, error);
+			return 1;
+		}
+	}
+	double load = since(start) / loads;
+	struct stat st;
+	stat(filename, &st);
+	unlink(filename);
+	printf("load %u states x %u events, %.1f MB: %.2f ms\n", nstates,
+	       nevents, st.st_size / 1e6, load * 1e3);
+	return 0;
+}
@@ -11,10 +11,18 @@
 #define __cthsm_hh__
 
 #include <deque>
+#include <vector>
 #include <cassert>
+#include <chrono>
+#include <new>
+#include <cstdlib>
 
 #include <iostream>
 
+#ifdef CTHSM_PROFILE
+#include "cthsm_profile.hh"
+#endif
+
 namespace CTHSM {
 
 
@@ -81,8 +89,31 @@ private:
 	int _event;
 };
 
+/**
+ * Something with a queue of events that can be told to handle them.
+ *
+ * CTHsm is derived from this class, so that schedulers and executors can
+ * run HSMs of different types without knowing their event types.
+ */
+class Runnable {
+public:
+	virtual ~Runnable() { };
+
+	/**
+	 * Handle queued events, within whatever budget has been set.
+	 *
+	 * \return true if there are still events waiting to be handled.
+	 */
+	virtual bool cthsmRun() = 0;
+
+	/**
+	 * \return true if there are events waiting to be handled.
+	 */
+	virtual bool cthsmPending() = 0;
+};
+
 template<typename C, typename E>
-class CTHsm {
+class CTHsm : public Runnable {
 
 protected:
 
@@ -159,6 +190,10 @@ protected:
 	 * new state.  Note that this can be called by a state that is not the
 	 * current state, in the case that an event is not handled and we start
 	 * traversing up to find a state function that does handle it.
+	 *
+	 * tact is called after the exit actions and before the entry actions.
+	 * It is not called for a transition from a state to itself, or for a
+	 * transition to or from the top state.
 	 */
 	CTHsmState cth_transition(State state, TransitionAction tact = 0) {
 		_transitionState = state;
@@ -166,6 +201,61 @@ protected:
 		return CTH_TRANSITION;
 	};
 
+	/**
+	 * Called by a state function to find out how many events the event
+	 * it is handling stands for.  This is 1, except for events with the
+	 * CTHQ_COUNTED queue policy, where it is the number of events that
+	 * were merged while the event waited in the queue.
+	 */
+	unsigned cth_event_count() {
+		return _eventCount;
+	};
+
+	/**
+	 * Post an internal event to this HSM.  This can only be called from
+	 * inside this HSM's state functions and transition actions.
+	 *
+	 * Internal events do not go through the event queue used by
+	 * sendEvent().  They are kept in a small fixed size buffer inside the
+	 * HSM, so posting a few never allocates memory.  This makes them a
+	 * cheap way for an HSM to tell itself that some step has completed.
+	 *
+	 * The ordering is:
+	 *
+	 * - internal events are handled in the order they were posted;
+	 *
+	 * - all the internal events posted while handling an event are
+	 *   handled after that event (and any transition it caused) is
+	 *   complete, and before the next event from sendEvent() is handled,
+	 *   no matter when that event was sent;
+	 *
+	 * - internal events posted while handling an internal event join the
+	 *   back of the same buffer, so they are handled before any event from
+	 *   sendEvent() as well.
+	 *
+	 * Internal events count as part of the event that caused them, so
+	 * they are not limited by cthsmSetBudget().
+	 *
+	 * Up to MAX_INTERNAL_EVENTS waiting events fit in the buffer.  If more
+	 * are posted, the rest wait in an overflow queue, which does allocate
+	 * memory, but keeps the order.
+	 */
+	void cth_post(E e) {
+		assert( _event_lock );
+
+		// Once anything has overflowed, later events must queue
+		// behind it, even if the buffer has room again.
+		if (_internalCount == MAX_INTERNAL_EVENTS
+		    || _internalOverflowHead != _internalOverflow.size()) {
+			_internalOverflow.push_back(e);
+			return;
+		}
+		unsigned tail = (_internalHead + _internalCount)
+			% MAX_INTERNAL_EVENTS;
+		new (internalSlot(tail)) E(e);
+		_internalCount++;
+	};
+
 	/**
 	 * A default top state that can be used by derived HSMs.
 	 *
@@ -188,20 +278,78 @@ protected:
 	 */
 	CTHsm<C,E>(State initial)
 		: _events(),
+		  _eventsHead(0),
+		  _eventsTail(0),
+		  _pending(),
+		  _eventCount(1),
 		  _event_lock(false),
+		  _budgetEvents(0),
+		  _budgetNanoseconds(0),
+		  _internalHead(0),
+		  _internalCount(0),
+		  _internalOverflow(),
+		  _internalOverflowHead(0),
+		  _registered(),
 		  _cthsmStartHasBeenCalled(false)
 	{
+#ifdef CTHSM_PROFILE
+		_profileOnExit = 0;
+#endif
 		_state = initial;
 	};
 
+	/**
+	 * Register a state so that its place in the hierarchy is checked by
+	 * cthsmStart().  Call this from the derived HSM's constructor, before
+	 * cthsmStart().
+	 *
+	 * Registering a state also checks all of its parents, so it is enough
+	 * to register the leaf states.  Every state that can be the target of
+	 * a transition should be registered, or be a parent of a registered
+	 * state.  Transitions only check the hierarchy as they walk it with
+	 * assertions, so in a build without them, a transition to a broken
+	 * part of the hierarchy that was never registered can loop forever.
+	 */
+	void cthsmRegister(State state) {
+		assert( ! _cthsmStartHasBeenCalled );
+		_registered.push_back(state);
+	};
+
 	/**
 	 * Do the transition to the initial state.  Derived state machines
 	 * should call this at the end of their constructors.  It must be
 	 * called before handling any events, in any case.
+	 *
+	 * The entry actions of the initial transition are treated like the
+	 * handling of an event: events they post with cth_post() are handled
+	 * when the transition is complete, and events they send with
+	 * sendEvent() after that.
+	 *
+	 * Before the initial transition, the hierarchy is checked by walking
+	 * up from the initial state and every state given to cthsmRegister().
+	 * If the hierarchy is broken (see cthsmValidate()), the problem is
+	 * reported on std::cerr and the program is aborted.  This check is
+	 * done in all builds, not only when assertions are enabled.
 	 */
 	void cthsmStart() {
+		States initial;
+		const char* error = validate(initial);
+		if (error) {
+			std::cerr << "CTHsm: " << error << "\n";
+			std::abort();
+		}
+		// The registered states are not needed again, so don't keep
+		// their memory for the life of the HSM.
+		std::vector<State>().swap(_registered);
 		_cthsmStartHasBeenCalled = true;
-		transitionFromTop(_state);
+		_event_lock = true;
+		// validate() has already found the path from the top state,
+		// so we don't ask for the parents again.
+		enter(initial);
+		sendInternalEvents();
+		_event_lock = false;
+		if (_events.size())
+			sendEvents();
 	};
 
 	/**
@@ -209,7 +357,33 @@ protected:
 	 * can undo all its actions on exit.
 	 */
 	virtual ~CTHsm<C,E>() {
-		exitTransition();
+		// If we never started, we never entered any states, and the
+		// hierarchy may not even be valid.
+		if (_cthsmStartHasBeenCalled) {
+			_event_lock = true;
+#ifdef CTHSM_PROFILE
+			State current = _state;
+			_profile.transitionBegin();
+#endif
+			exitTransition();
+#ifdef CTHSM_PROFILE
+			_profile.transitionEnd(current, _state);
+#endif
+			// Anything posted by the exit actions will never be
+			// handled.
+			while (_internalCount) {
+				internalSlot(_internalHead)->~E();
+				_internalHead = (_internalHead + 1)
+					% MAX_INTERNAL_EVENTS;
+				_internalCount--;
+			}
+			_internalOverflow.clear();
+		}
+#ifdef CTHSM_PROFILE
+		// After the exits, so that the report includes them.
+		if (_profileOnExit)
+			cthsmProfileReport(*_profileOnExit);
+#endif
 	};
 
 public:
@@ -220,15 +394,287 @@ public:
 	 * derived HSM needs is a source of events.  This source can be the HSM
 	 * itself (perhaps it's a derived class of a GUI object), or something
 	 * external.
+	 *
+	 * If a budget has been set with cthsmSetBudget(), this may return
+	 * before all the queued events have been handled.  Call cthsmRun()
+	 * later to handle the rest.
+	 *
+	 * \return true if there are still events waiting to be handled.
 	 */
-	void sendEvent(E e) {
+	bool sendEvent(E e) {
 		assert( _cthsmStartHasBeenCalled );
 
-		_events.push_back(e);
+		enqueue(e);
 		if (! _event_lock)
-			sendEvents();
+			return sendEvents();
+		return true;
+	};
+
+	/**
+	 * Send the same event to many HSMs of this class.
+	 *
+	 * The result for each HSM is the same as calling sendEvent(e) on it,
+	 * but when many HSMs take the same transition (a configuration
+	 * reload moving a whole fleet from one state to another, say), the
+	 * work of the transition is shared.  The HSMs are taken in blocks of
+	 * BULK_BLOCK.  First the event is given to each HSM's states, and the
+	 * HSMs that want a transition are grouped by source state,
+	 * destination state and transition action.  Then for each group, each
+	 * exit action, the transition action, and each entry action in turn
+	 * is called for every HSM in the group before the next one.  The path
+	 * of each group's transition is found once for the whole call.
+	 *
+	 * So the actions of one HSM are called in the same order as with
+	 * sendEvent(), but the actions of different HSMs are interleaved.
+	 * Each HSM's internal events, and the events queued while it was
+	 * handling this one, are handled when its transition is done.
+	 *
+	 * A group's path is found from the first HSM in it, so a state's
+	 * parent must be the same in all the HSMs, as it is when the state
+	 * functions don't look at per-HSM data to choose it.  That is checked
+	 * by assertions.
+	 *
+	 * An HSM that already has queued events, or that is inside one of
+	 * its own state functions, gets e with sendEvent().  So does every
+	 * HSM when CTHSM_PROFILE is defined, so that profiles are exact.
+	 *
+	 * e does not count against a budget set with cthsmSetBudget(), but
+	 * events queued while it is handled do.
+	 *
+	 * \arg hsms the HSMs.  An HSM that appears twice gets e twice.
+	 * \arg n the number of HSMs.
+	 * \arg e the event.
+	 */
+	static void cthsmBulkSend(C* const* hsms, size_t n, E e) {
+#ifdef CTHSM_PROFILE
+		for (size_t i = 0; i < n; i++)
+			hsms[i]->sendEvent(e);
+#else
+		std::vector<BulkGroup> groups;
+		for (size_t from = 0; from < n; from += BULK_BLOCK) {
+			size_t to = from + BULK_BLOCK < n ? from + BULK_BLOCK : n;
+			bulkBlock(hsms + from, to - from, e, groups);
+		}
+#endif
+	};
+
+	/**
+	 * Queue an event for this HSM, but don't handle it yet.  The event
+	 * will be handled by the next call to sendEvent() or cthsmRun().
+	 *
+	 * This is for schedulers and executors that collect events for many
+	 * HSMs, and then run each HSM once for all of its events.
+	 */
+	void cthsmQueueEvent(E e) {
+		enqueue(e);
+	};
+
+	/**
+	 * How the event queue treats a new event when there is already an
+	 * event with the same number waiting.  See cthsmSetQueuePolicy().
+	 */
+	enum QueuePolicy {
+		/**
+		 * Queue every event.  This is the default.
+		 */
+		CTHQ_ALL,
+		/**
+		 * Replace the waiting event with the new one.  The new event
+		 * takes the waiting event's place in the queue, so only the
+		 * latest event is handled, as early as the first one would
+		 * have been.
+		 */
+		CTHQ_COALESCE,
+		/**
+		 * Drop the new event.  Only the first is handled.
+		 */
+		CTHQ_DEDUP,
+		/**
+		 * Drop the new event, but count it.  The first event is
+		 * handled, and cth_event_count() tells the state function how
+		 * many events it stands for.
+		 */
+		CTHQ_COUNTED,
+	};
+
+	/**
+	 * Set the queue policy for an event number.
+	 *
+	 * When an HSM is flooded with events that say the same thing ("data
+	 * available", "something changed"), handling each of them is wasted
+	 * work.  With a policy other than CTHQ_ALL, the queue holds at most
+	 * one event with that number, and later ones are merged into it as
+	 * the policy says.  The queue keeps track of the waiting event for
+	 * each number, so merging does not search the queue.
+	 *
+	 * Policies only apply to events queued by sendEvent() and
+	 * cthsmQueueEvent(), not to internal events from cth_post().  Events
+	 * that were queued before the policy was set are not merged.
+	 *
+	 * CTHQ_COALESCE needs E to be assignable.
+	 *
+	 * \arg event the event number.  Must not be negative.
+	 * \arg policy the policy.
+	 */
+	void cthsmSetQueuePolicy(int event, QueuePolicy policy) {
+		assert( event >= 0 );
+		if (unsigned(event) >= _pending.size())
+			_pending.resize(event + 1);
+		_pending[event].policy = policy;
+	};
+
+	/**
+	 * Limit the work done each time the event queue is drained.
+	 *
+	 * Without a budget, sendEvent() and cthsmRun() handle events until the
+	 * queue is empty.  An HSM that keeps sending events to itself, or that
+	 * gets a burst of events, can then keep the calling thread busy for a
+	 * long time, and other HSMs sharing that thread have to wait.
+	 *
+	 * With a budget, the queue is drained until the budget runs out, and
+	 * the caller is told that there is more to do.  The caller (perhaps a
+	 * scheduler running many HSMs) can then call cthsmRun() again when it
+	 * is this HSM's turn.
+	 *
+	 * The budget is only checked between events.  Each event is still
+	 * handled to completion, including any transition it causes, and at
+	 * least one event is handled on each call.
+	 *
+	 * \arg events the maximum number of events to handle on each call.
+	 * 0 means no limit.
+	 * \arg nanoseconds the time after which no more events are started on
+	 * each call.  0 means no limit.
+	 */
+	void cthsmSetBudget(unsigned events, unsigned long nanoseconds = 0) {
+		_budgetEvents = events;
+		_budgetNanoseconds = nanoseconds;
+	};
+
+	/**
+	 * Handle queued events, within the budget set by cthsmSetBudget().
+	 * Calling this from inside one of this HSM's state functions does
+	 * nothing, since the queued events will be handled when that state
+	 * function returns.
+	 *
+	 * \return true if there are still events waiting to be handled.
+	 */
+	virtual bool cthsmRun() {
+		assert( _cthsmStartHasBeenCalled );
+
+		if (_event_lock)
+			return true;
+		return sendEvents();
+	};
+
+	/**
+	 * \return true if there are events waiting to be handled.
+	 */
+	virtual bool cthsmPending() {
+		return _events.size() != 0;
+	};
+
+	/**
+	 * Find out if this HSM is in a state.
+	 *
+	 * The HSM is in a state if that state is the current state, or if it
+	 * is one of the parents of the current state.  The parents are found
+	 * by sending CTHE_PARENT to each state in turn, so this costs one
+	 * call for each level of the hierarchy that we walk up.
+	 *
+	 * \arg state the state to look for.
+	 * \return true if state is the current state or one of its parents.
+	 */
+	bool cthsmInState(State state) {
+		State s = _state;
+		for (;;) {
+			if (s == state)
+				return true;
+			if (CTH_HANDLED == s1(Event::CTHE_PARENT, s))
+				return false;
+			s = _parentState;
+		}
+	};
+
+	/**
+	 * Check the state hierarchy.
+	 *
+	 * We walk up from the current state (the initial state, before
+	 * cthsmStart() is called) and, until cthsmStart() is called, from
+	 * every registered state, and check that:
+	 *
+	 * - no state is its own parent, grandparent, etc;
+	 *
+	 * - no path from a state to the top is longer than MAX_DEPTH; and
+	 *
+	 * - all paths end at the same top state.
+	 *
+	 * cthsmStart() does this check, so there is no need to call this
+	 * directly unless you want to test a hierarchy without aborting.
+	 *
+	 * \return 0 if the hierarchy is valid, or a description of the first
+	 * problem found.
+	 */
+	const char* cthsmValidate() {
+		States chain;
+		return validate(chain);
+	};
+
+	/**
+	 * Give a state a name, for the profile report.  Unnamed states are
+	 * shown by the address of their function.
+	 *
+	 * Profiling is only done when CTHSM_PROFILE is defined.  Otherwise,
+	 * this and the other cthsmProfile functions do nothing, so they can
+	 * be left in the code at no cost.
+	 */
+	void cthsmProfileName(State state, const char* name) {
+#ifdef CTHSM_PROFILE
+		_profile.name(state, name);
+#endif
+	};
+
+	/**
+	 * Write the profile report now.
+	 *
+	 * For each (src,dst) transition, and for each event handled in each
+	 * state, the report shows the number of calls and the (estimated)
+	 * cycles spent.  Transitions also show how many CTHE_PARENT queries,
+	 * exit actions and entry actions each one needed, and dispatches show
+	 * how many times the event was passed to a parent state.  Both lists
+	 * are sorted with the most expensive first, so the top of each list
+	 * shows which transitions are worth flattening or caching.
+	 */
+	void cthsmProfileReport(std::ostream& out) {
+#ifdef CTHSM_PROFILE
+		_profile.report(out);
+#endif
+	};
+
+	/**
+	 * Write the profile report when this HSM is destroyed.  The report is
+	 * written after the exit actions, and shows the exits as a
+	 * transition from the last state to the top state.
+	 *
+	 * \arg out where to write the report, or 0 for no report.
+	 */
+	void cthsmProfileReportOnExit(std::ostream* out) {
+#ifdef CTHSM_PROFILE
+		_profileOnExit = out;
+#endif
 	};
 
+#ifdef CTHSM_PROFILE
+	typedef Profile<State> StateProfile;
+
+	/**
+	 * The profile figures, for programs that want to look at them
+	 * directly.  Only available when CTHSM_PROFILE is defined.
+	 */
+	const StateProfile& cthsmProfile() const {
+		return _profile;
+	};
+#endif
+
 private:
 	/**
 	 * The current HSM state.  Also set in the constructor so we can do the
@@ -259,6 +705,95 @@ private:
 	 */
 	std::deque<E> _events;
 
+	/**
+	 * Sequence number of the event at the front of _events.  Each event
+	 * queued gets the next sequence number, so an event's place in
+	 * _events is its sequence number minus _eventsHead.
+	 */
+	unsigned long _eventsHead;
+
+	/**
+	 * Sequence number for the next event queued.
+	 */
+	unsigned long _eventsTail;
+
+	/**
+	 * The queue policy for an event number, and the waiting event with
+	 * that number, if there is one.
+	 */
+	struct Pending {
+		Pending() : policy(CTHQ_ALL), queued(false), seq(0),
+			    count(0) { };
+		QueuePolicy policy;
+		/** Set if an event with this number is in _events. */
+		bool queued;
+		/** The sequence number of that event. */
+		unsigned long seq;
+		/** The number of events merged into it. */
+		unsigned count;
+	};
+
+	/**
+	 * Queue policies, indexed by event number.  Empty unless
+	 * cthsmSetQueuePolicy() has been called, and then only as long as
+	 * the highest event number with a policy.
+	 */
+	std::vector<Pending> _pending;
+
+	/**
+	 * The number of events that the event being handled stands for.
+	 * See cth_event_count().
+	 */
+	unsigned _eventCount;
+
+	/**
+	 * Add an event to _events, applying the queue policy for its number.
+	 */
+	void enqueue(E e) {
+		int n = e.event();
+		if (n >= 0 && unsigned(n) < _pending.size()
+		    && _pending[n].policy != CTHQ_ALL) {
+			Pending& p = _pending[n];
+			if (p.queued) {
+				switch (p.policy) {
+				case CTHQ_COALESCE:
+					_events[p.seq - _eventsHead] = e;
+					return;
+				case CTHQ_COUNTED:
+					p.count++;
+					return;
+				default:
+					return;
+				}
+			}
+			p.queued = true;
+			p.seq = _eventsTail;
+			p.count = 1;
+		}
+		_events.push_back(e);
+		_eventsTail++;
+	};
+
+	/**
+	 * Take the event at the front of _events, and set _eventCount for
+	 * it.
+	 */
+	E dequeue() {
+		E e = _events.front();
+		_events.pop_front();
+		unsigned long seq = _eventsHead++;
+		_eventCount = 1;
+		int n = e.event();
+		if (n >= 0 && unsigned(n) < _pending.size()) {
+			Pending& p = _pending[n];
+			if (p.queued && p.seq == seq) {
+				_eventCount = p.count;
+				p.queued = false;
+			}
+		}
+		return e;
+	};
+
 	/**
 	 * Lock to make sure that while we are busy handling an event, any
 	 * events sent to us will be queued.
@@ -276,6 +811,13 @@ private:
 	inline CTHsmState s1(int n, State s=0) {
 		if (!s)
 			s = _state;
+#ifdef CTHSM_PROFILE
+		switch (n) {
+		case Event::CTHE_PARENT: _profile.parentQuery(); break;
+		case Event::CTHE_EXIT:   _profile.exitAction();  break;
+		case Event::CTHE_ENTRY:  _profile.entryAction(); break;
+		}
+#endif
 		return (static_cast<C*>(this)->*s)(E(n));
 	};
 
@@ -294,54 +836,404 @@ private:
 	};
 
 	/**
-	 * While there are events in our queue, handle them.
+	 * The maximum number of events handled by one call to sendEvents(), or
+	 * 0 for no limit.  Set by cthsmSetBudget().
+	 */
+	unsigned _budgetEvents;
+
+	/**
+	 * The maximum time spent in one call to sendEvents(), or 0 for no
+	 * limit.  Set by cthsmSetBudget().
+	 */
+	unsigned long _budgetNanoseconds;
+
+	/**
+	 * The number of internal events that can be waiting at once.  See
+	 * cth_post().
 	 */
-	void sendEvents() {
+	static const unsigned MAX_INTERNAL_EVENTS = 8;
+
+	/**
+	 * Storage for the internal events posted by cth_post().  This is used
+	 * as a ring buffer of MAX_INTERNAL_EVENTS events, and events are
+	 * constructed in it only when they are posted, so E does not need a
+	 * default constructor.
+	 */
+	alignas(E) unsigned char _internal[MAX_INTERNAL_EVENTS * sizeof(E)];
+
+	/**
+	 * Index in _internal of the oldest internal event.
+	 */
+	unsigned _internalHead;
+
+	/**
+	 * Number of internal events waiting in _internal.
+	 */
+	unsigned _internalCount;
+
+	/**
+	 * Internal events posted while _internal was full, and after them.
+	 * Every event here was posted after every event in _internal.  A
+	 * vector, so that it costs nothing until it is used.
+	 */
+	std::vector<E> _internalOverflow;
+
+	/**
+	 * Index in _internalOverflow of the oldest event not yet handled.
+	 */
+	unsigned _internalOverflowHead;
+
+	E* internalSlot(unsigned i) {
+		return reinterpret_cast<E*>(_internal) + i;
+	};
+
+	/**
+	 * Handle the internal events posted by cth_post(), until there are
+	 * none left.  Called with _event_lock set, straight after handling an
+	 * event.
+	 */
+	void sendInternalEvents() {
+		for (;;) {
+			if (_internalCount) {
+				E* slot = internalSlot(_internalHead);
+				E e = *slot;
+				slot->~E();
+				_internalHead = (_internalHead + 1)
+					% MAX_INTERNAL_EVENTS;
+				_internalCount--;
+				_eventCount = 1;
+				send1Event(e);
+			} else if (_internalOverflowHead
+				   != _internalOverflow.size()) {
+				E e = _internalOverflow[_internalOverflowHead++];
+				if (_internalOverflowHead
+				    == _internalOverflow.size()) {
+					_internalOverflow.clear();
+					_internalOverflowHead = 0;
+				}
+				_eventCount = 1;
+				send1Event(e);
+			} else {
+				return;
+			}
+		}
+	};
+
+	/**
+	 * While there are events in our queue, handle them, until we run out
+	 * of budget.
+	 *
+	 * \return true if there are still events in the queue.
+	 */
+	bool sendEvents() {
+		typedef std::chrono::steady_clock Clock;
+		Clock::time_point deadline;
+		if (_budgetNanoseconds) {
+			deadline = Clock::now()
+				+ std::chrono::nanoseconds(_budgetNanoseconds);
+		}
+		unsigned handled = 0;
 		while (_events.size()) {
-			E e = _events.front();
-			_events.pop_front();
+			E e = dequeue();
 			_event_lock = true;
 			send1Event(e);
+			sendInternalEvents();
 			_event_lock = false;
+			handled++;
+			if (_budgetEvents && handled >= _budgetEvents)
+				break;
+			if (_budgetNanoseconds && Clock::now() >= deadline)
+				break;
 		}
+		return _events.size() != 0;
 	};
 
 	void send1Event(E e) {
-		// Save a copy of the current state so the loop below does not
+#ifdef CTHSM_PROFILE
+		State current = _state;
+		_profile.dispatchBegin();
+#endif
+		if (CTH_TRANSITION == dispatch(e)) {
+#ifdef CTHSM_PROFILE
+			_profile.transitionBegin();
+#endif
+			transition(_state, _transitionState,
+				   _transitionAction);
+#ifdef CTHSM_PROFILE
+			_profile.transitionEnd(current, _state);
+#endif
+		}
+#ifdef CTHSM_PROFILE
+		_profile.dispatchEnd(current, e.event());
+#endif
+	};
+
+	/**
+	 * Give an event to the current state, and then to its parents, until
+	 * one of them handles it.
+	 *
+	 * \return CTH_TRANSITION if the state that handled the event asked
+	 * for a transition.  The transition has not been done yet; its
+	 * destination and action are in _transitionState and
+	 * _transitionAction.  Otherwise CTH_HANDLED.
+	 */
+	CTHsmState dispatch(E e) {
+		// Use a copy of the current state so the loop below does not
 		// change the current state.  If necessary, the current state
 		// will be changed by transition().
 		State state = _state;
-		CTHsmState s;
-		do {
-			s = s1(e, state);
-			switch (s) {
-			case CTH_HANDLED:
-				break;
-			case CTH_PARENT:
-				state = _parentState;
-				break;
-			case CTH_TRANSITION:
-				transition(_state, _transitionState,
-					   _transitionAction);
-				// Force a break from the while loop.
-				s = CTH_HANDLED;
-				break;
+		for (;;) {
+			CTHsmState s = s1(e, state);
+			if (s != CTH_PARENT)
+				return s;
+			state = _parentState;
+#ifdef CTHSM_PROFILE
+			_profile.bubble();
+#endif
+		}
+	};
+
+	/**
+	 * The kinds of path found by transitionPath().
+	 */
+	enum PathKind {
+		/** An ordinary path, with exit and entry lists. */
+		CTHP_PATH,
+		/** The source is the top state. */
+		CTHP_FROM_TOP,
+		/** The destination is the top state. */
+		CTHP_TO_TOP,
+	};
+
+	/**
+	 * The number of HSMs that cthsmBulkSend() takes at a time.  A block
+	 * is small enough to stay in the cache while each step of its
+	 * transitions is done across the whole block, so a large fleet is
+	 * not read from memory once per step.
+	 */
+	static const size_t BULK_BLOCK = 256;
+
+	/**
+	 * HSMs in one block of a cthsmBulkSend() that are doing the same
+	 * transition.  The path is found for the first block that has HSMs
+	 * in the group, and kept for the rest of the call.
+	 */
+	struct BulkGroup {
+		BulkGroup() : src(0), dst(0), tact(0), found(false),
+			      kind(CTHP_PATH), srcs(), dsts(), hsms() { };
+		State src;
+		State dst;
+		TransitionAction tact;
+		bool found;
+		PathKind kind;
+		States srcs;
+		States dsts;
+		std::vector<CTHsm<C,E>*> hsms;
+	};
+
+	/**
+	 * Give e to one block of HSMs, and do their transitions group by
+	 * group.  groups is kept from one block to the next, with each
+	 * group's list of HSMs emptied.
+	 */
+	static void bulkBlock(C* const* hsms, size_t n, E e,
+			      std::vector<BulkGroup>& groups) {
+		for (size_t i = 0; i < n; i++) {
+			CTHsm<C,E>* h = hsms[i];
+			assert( h->_cthsmStartHasBeenCalled );
+			if (h->_event_lock || h->_events.size()) {
+				h->sendEvent(e);
+				continue;
+			}
+			h->_event_lock = true;
+			h->_eventCount = 1;
+			if (CTH_TRANSITION != h->dispatch(e)) {
+				h->bulkFinish();
+				continue;
+			}
+			// There are usually only a few groups, so a linear
+			// search is fine.
+			unsigned g;
+			for (g = 0; g < groups.size(); g++) {
+				if (groups[g].src == h->_state
+				    && groups[g].dst == h->_transitionState
+				    && groups[g].tact == h->_transitionAction)
+					break;
 			}
-		} while (s != CTH_HANDLED);
+			if (g == groups.size()) {
+				groups.push_back(BulkGroup());
+				groups[g].src = h->_state;
+				groups[g].dst = h->_transitionState;
+				groups[g].tact = h->_transitionAction;
+			}
+			groups[g].hsms.push_back(h);
+		}
+		for (unsigned g = 0; g < groups.size(); g++) {
+			if (groups[g].hsms.size()) {
+				bulkTransition(groups[g]);
+				groups[g].hsms.clear();
+			}
+		}
+	};
+
+	/**
+	 * Do one transition for every HSM in a group.  The path is found
+	 * using the first HSM, and then each step of the transition is done
+	 * for every HSM before the next step.  The other HSMs must have the
+	 * same path, which is only checked by an assertion.
+	 */
+	static void bulkTransition(BulkGroup& g) {
+		typename std::vector<CTHsm<C,E>*>::const_iterator h;
+		if (! g.found) {
+			g.found = true;
+			if (g.src == g.dst) {
+				// As in transition(), a self transition has
+				// no transition action.
+				g.srcs.push_back(g.src);
+				g.dsts.push_back(g.dst);
+				g.tact = 0;
+			} else {
+				g.kind = g.hsms[0]->transitionPath(
+					g.src, g.dst, g.srcs, g.dsts);
+			}
+		}
+		if (g.kind != CTHP_PATH) {
+			for (h = g.hsms.begin(); h != g.hsms.end(); h++) {
+				(*h)->transition(g.src, g.dst, g.tact);
+				(*h)->bulkFinish();
+			}
+			return;
+		}
+		assert( g.src == g.dst || samePath(g) );
+
+		States_const_iterator srcit;
+		for (srcit = g.srcs.begin(); srcit != g.srcs.end(); srcit++) {
+			for (h = g.hsms.begin(); h != g.hsms.end(); h++)
+				(*h)->s1(Event::CTHE_EXIT, *srcit);
+		}
+		if (g.tact) {
+			for (h = g.hsms.begin(); h != g.hsms.end(); h++)
+				(static_cast<C*>(*h)->*g.tact)();
+		}
+		States_const_reverse_iterator dstit;
+		for (dstit = g.dsts.rbegin(); dstit != g.dsts.rend(); dstit++) {
+			for (h = g.hsms.begin(); h != g.hsms.end(); h++)
+				(*h)->s1(Event::CTHE_ENTRY, *dstit);
+		}
+		for (h = g.hsms.begin(); h != g.hsms.end(); h++) {
+			(*h)->_state = g.dst;
+			(*h)->bulkFinish();
+		}
+	};
+
+	/**
+	 * \return true if every HSM in a group has the group's path for its
+	 * transition.
+	 */
+	static bool samePath(const BulkGroup& g) {
+		for (size_t i = 1; i < g.hsms.size(); i++) {
+			States hsrcs;
+			States hdsts;
+			if (CTHP_PATH != g.hsms[i]->transitionPath(g.src, g.dst,
+								   hsrcs, hdsts)
+			    || hsrcs != g.srcs || hdsts != g.dsts)
+				return false;
+		}
+		return true;
+	};
+
+	/**
+	 * Finish an event handled by cthsmBulkSend(), as sendEvents() would.
+	 */
+	void bulkFinish() {
+		sendInternalEvents();
+		_event_lock = false;
+		if (_events.size())
+			sendEvents();
 	};
 
 	/**
 	 * The maximum depth of any part of the state hierarchy.  A hierarchy
 	 * can theoretically be deeper than this, but we set a limit to catch
-	 * errors.
+	 * errors.  Checked by cthsmStart(), and by assertions as transitions
+	 * walk the hierarchy.
 	 */
 	static const unsigned MAX_DEPTH = 10;
 
+	/**
+	 * States given to cthsmRegister(), to be checked by cthsmStart().
+	 * Emptied by cthsmStart().
+	 */
+	std::vector<State> _registered;
+
 	/**
 	 * Set when cthsmStart() has been called.
 	 */
 	bool _cthsmStartHasBeenCalled;
 
+#ifdef CTHSM_PROFILE
+	/**
+	 * Where to write the profile report when we are destroyed.  Set by
+	 * cthsmProfileReportOnExit().
+	 */
+	std::ostream* _profileOnExit;
+
+	/**
+	 * Figures for the profile report.
+	 */
+	Profile<State> _profile;
+#endif
+
+	/**
+	 * Check the hierarchy above every registered state, and above the
+	 * current state.
+	 *
+	 * \arg chain set to the path from the top state down to the current
+	 * state, if the hierarchy is valid.
+	 * \return 0 if the hierarchy is valid, or a description of the
+	 * first problem found.
+	 */
+	const char* validate(States& chain) {
+		State top = 0;
+		const char* error;
+		for (unsigned i = 0; i < _registered.size(); i++) {
+			chain.clear();
+			error = validateChain(_registered[i], chain, top);
+			if (error)
+				return error;
+		}
+		chain.clear();
+		return validateChain(_state, chain, top);
+	};
+
+	/**
+	 * Walk up from one state to the top state.
+	 *
+	 * \arg state the state to start from.
+	 * \arg chain filled with the path from the top state down to state.
+	 * \arg top the top state found by earlier walks, or 0 if there have
+	 * been none.  Set to the top state found by this walk.
+	 * \return 0 if the path is valid, or a description of the problem.
+	 */
+	const char* validateChain(State state, States& chain, State& top) {
+		chain.push_front(state);
+		while (CTH_HANDLED != s1(Event::CTHE_PARENT, state)) {
+			state = _parentState;
+			States_const_iterator it;
+			for (it = chain.begin(); it != chain.end(); it++) {
+				if (*it == state)
+					return "state hierarchy has a cycle";
+			}
+			if (chain.size() >= MAX_DEPTH)
+				return "state hierarchy is deeper than MAX_DEPTH";
+			chain.push_front(state);
+		}
+		if (top && top != state)
+			return "state hierarchy has more than one top state";
+		top = state;
+		return 0;
+	};
+
 	/**
 	 * Transition from one state to another.
 	 *
@@ -368,12 +1260,15 @@ private:
 	 *
 	 * \arg src the source state (where we start)
 	 * \arg dst the destination state (where we end up)
-	 * \arg tact the action to perform in the middle of the transition
+	 * \arg tact the action to perform in the middle of the transition.
+	 * Not called when src is dst, or when either of them is the top state.
+	 *
+	 * cthsmStart() has checked the hierarchy above the registered states.
+	 * A transition to a state that was not registered is only checked for
+	 * cycles, excessive depth and multiple top states by assertions.
 	 */
 	void transition(State src, State dst, TransitionAction tact)
 	{
-		assert( _cthsmStartHasBeenCalled );
-
 		if (src == dst) {
 			// We are transitioning from a state to itself, so call
 			// the exit and then the entry actions.
@@ -382,32 +1277,79 @@ private:
 			return;
 		}
 
-		// Find out the parent states for src and dst just once.
-		State src_parent = 0;
-		if ( CTH_HANDLED == s1(Event::CTHE_PARENT, src) ) {
+		States srcs;
+		States dsts;
+		switch (transitionPath(src, dst, srcs, dsts)) {
+		case CTHP_FROM_TOP:
 			// Degenerate case: transition from the top state.
 			transitionFromTop(dst);
+			_state = dst;
+			return;
+		case CTHP_TO_TOP:
+			transitionToTop(src);
 			return;
+		case CTHP_PATH:
+			break;
+		}
+
+		// Now call the exit action for the src states in forward list
+		// order
+		States_const_iterator srcit;
+		for (srcit = srcs.begin(); srcit != srcs.end(); srcit++) {
+			State s = *srcit;
+			s1(Event::CTHE_EXIT, s);
+		}
+
+		// ... and the transition action, if specified.
+		if (tact) {
+			(static_cast<C*>(this)->*tact)();
+		}
+
+		// ... and the entry actions for the dst states in reverse list
+		// order.
+		States_const_reverse_iterator dstit;
+		for (dstit = dsts.rbegin(); dstit != dsts.rend(); dstit++) {
+			State d = *dstit;
+			s1(Event::CTHE_ENTRY, d);
+		}
+
+		// Save the destination state as the current state.  This will
+		// be the state that gets first cut at events from now on.
+		_state = dst;
+	};
+
+	/**
+	 * Find the path of a transition between two different states.
+	 *
+	 * \arg src the source state.
+	 * \arg dst the destination state.  Must not be the same as src.
+	 * \arg srcs set to the states to exit, in order.
+	 * \arg dsts set to the states to enter, in reverse order.
+	 * \return CTHP_PATH if srcs and dsts were set, or which of the
+	 * degenerate transitions to or from the top state this is.
+	 */
+	PathKind transitionPath(State src, State dst, States& srcs, States& dsts)
+	{
+		// Find out the parent states for src and dst just once.
+		State src_parent = 0;
+		if ( CTH_HANDLED == s1(Event::CTHE_PARENT, src) ) {
+			return CTHP_FROM_TOP;
 		} else {
 			src_parent = _parentState;
 		}
 		State dst_parent = 0;
 		if ( CTH_HANDLED == s1(Event::CTHE_PARENT, dst) ) {
-			transitionToTop(src);
-			return;
+			return CTHP_TO_TOP;
 		} else {
 			dst_parent = _parentState;
 		}
 
-		States srcs;
-		States dsts;
 		srcs.push_back(src);
 		dsts.push_back(dst);
 		// We got the parent states of src and dst earlier, so push
 		// them onto the lists.  If either of these is not valid (ie if
 		// either src or dst was the top state), then we've already
-		// done a transition from or to the top state, and control will
-		// never get here.  Assert that.
+		// returned, and control will never get here.  Assert that.
 		assert( src_parent );
 		srcs.push_back(src_parent);
 		assert( dst_parent );
@@ -477,31 +1419,7 @@ private:
 		// state, so remove it from both lists.
 		srcs.pop_back();
 		dsts.pop_back();
-
-		// Now call the exit action for the src states in forward list
-		// order
-		States_const_iterator srcit;
-		for (srcit = srcs.begin(); srcit != srcs.end(); srcit++) {
-			State s = *srcit;
-			s1(Event::CTHE_EXIT, s);
-		}
-
-		// ... and the transition action, if specified.
-		if (tact) {
-			(static_cast<C*>(this)->*tact)();
-		}
-
-		// ... and the entry actions for the dst states in reverse list
-		// order.
-		States_const_reverse_iterator dstit;
-		for (dstit = dsts.rbegin(); dstit != dsts.rend(); dstit++) {
-			State d = *dstit;
-			s1(Event::CTHE_ENTRY, d);
-		}
-
-		// Save the destination state as the current state.  This will
-		// be the state that gets first cut at events from now on.
-		_state = dst;
+		return CTHP_PATH;
 	};
 
 	/**
@@ -562,8 +1480,6 @@ private:
 	/** The simple transition from the top state to a destination. */
 	void transitionFromTop(State dst)
 	{
-		assert( _cthsmStartHasBeenCalled );
-
 		States dests;
 		dests.push_front(dst);
 		State state = dst;
@@ -574,7 +1490,15 @@ private:
 			state = _parentState;
 		}
 
+		enter(dests);
+	};
 
+	/**
+	 * Call the entry actions for a path of states, from the front of the
+	 * list to the back.
+	 */
+	void enter(const States& dests)
+	{
 		States_const_iterator i;
 		for (i=dests.begin(); i != dests.end(); i++) {
 			s1(Event::CTHE_ENTRY, (*i));
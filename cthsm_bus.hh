@@ -0,0 +1,481 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef __cthsm_bus_hh__
+#define __cthsm_bus_hh__
+
+#include "cthsm.hh"
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+#include <cassert>
+
+namespace CTHSM {
+
+
+/**
+ * An event that carries a shared, immutable payload.
+ *
+ * When one event is published to many HSMs, each HSM gets its own copy of
+ * the event.  If the event carries a large payload, copying that payload
+ * for every HSM is wasteful.  SharedEvent keeps the payload in one
+ * reference-counted object, so copying the event copies only a pointer and
+ * the event number.
+ *
+ * The payload is const, so no HSM can change what the others see.
+ *
+ * SharedEvent satisfies the requirements of an event type for CTHsm: it has
+ * a constructor taking a single int, and an event() method.
+ */
+template<typename P>
+class SharedEvent : public Event {
+public:
+	/**
+	 * Make an event with no payload.  CTHsm uses this constructor for
+	 * its own CTHE_PARENT, CTHE_ENTRY and CTHE_EXIT events.
+	 */
+	SharedEvent(int event) : Event(event), _payload() { };
+
+	/**
+	 * Make an event with a payload.
+	 */
+	SharedEvent(int event, std::shared_ptr<const P> payload)
+		: Event(event), _payload(payload) { };
+
+	/**
+	 * Get the payload, or 0 if there is none.
+	 */
+	const P* payload() const {
+		return _payload.get();
+	};
+
+	/**
+	 * Get the reference to the payload, for handlers that want to keep
+	 * the payload after the event has been handled.
+	 */
+	std::shared_ptr<const P> sharedPayload() const {
+		return _payload;
+	};
+
+private:
+	std::shared_ptr<const P> _payload;
+};
+
+
+/**
+ * One subscription on an EventBus.
+ *
+ * Each subscription knows how to offer an event to its HSM.  An offer
+ * checks that the subscription is still active and the optional state
+ * filter and, if those pass, sends the event to the HSM.
+ *
+ * Subscriptions are reference counted.  The bus holds one reference, and
+ * each batch handed to a BusDispatcher holds another, so a subscription
+ * outlives EventBus::unsubscribe() for as long as a dispatcher still has it.
+ * Unsubscribing cancels the subscription, and a cancelled subscription
+ * never touches its HSM again.  unsubscribe() does not wait for an offer
+ * already in progress, so an HSM can only be destroyed as soon as
+ * unsubscribe() returns if both are done on the thread that owns the HSM,
+ * which is where its dispatcher calls offer().
+ */
+template<typename E>
+class BusSubscriber {
+public:
+	BusSubscriber() : _cancelled(false) { };
+
+	virtual ~BusSubscriber() { };
+
+	/**
+	 * Offer an event to the subscribed HSM.  This must be called from
+	 * the thread that owns the HSM.
+	 *
+	 * \return true if the event was sent to the HSM.
+	 */
+	bool offer(E e) {
+		if (_cancelled.load(std::memory_order_acquire))
+			return false;
+		return deliver(e);
+	};
+
+	/**
+	 * The HSM that this subscription belongs to.  This is used only to
+	 * identify the subscription for EventBus::unsubscribe().
+	 */
+	virtual const void* hsm() const = 0;
+
+	/**
+	 * \return false once the subscription has been cancelled.
+	 */
+	bool active() const {
+		return ! _cancelled.load(std::memory_order_acquire);
+	};
+
+	/**
+	 * Stop offering events to the HSM.  Called by
+	 * EventBus::unsubscribe().
+	 */
+	void cancel() {
+		_cancelled.store(true, std::memory_order_release);
+	};
+
+protected:
+	/**
+	 * Send an event to the HSM, if the filter allows it.
+	 *
+	 * \return true if the event was sent.
+	 */
+	virtual bool deliver(E e) = 0;
+
+private:
+	std::atomic<bool> _cancelled;
+};
+
+
+/**
+ * A destination for batches of published events.
+ *
+ * With no dispatcher, EventBus::publish() offers the event to each
+ * subscriber in the publishing thread.  When HSMs are run by several
+ * worker threads, each worker can provide a BusDispatcher.  publish() then
+ * collects all the subscribers that share a dispatcher, and hands them to
+ * that dispatcher in one call, so each worker is woken at most once per
+ * published event.
+ *
+ * The dispatcher must arrange for BusSubscriber::offer() to be called for
+ * each subscriber in the batch, from the thread that owns the subscriber's
+ * HSM.  The batch is only valid during dispatch(), so a dispatcher that
+ * delivers later must copy it.  The copy keeps the subscriptions alive, and
+ * offer() does nothing for the ones that have since been unsubscribed.
+ */
+template<typename E>
+class BusDispatcher {
+public:
+	typedef std::vector<std::shared_ptr<BusSubscriber<E> > > Batch;
+
+	virtual ~BusDispatcher() { };
+
+	/**
+	 * Deliver e to every subscriber in batch.
+	 */
+	virtual void dispatch(E e, const Batch& batch) = 0;
+};
+
+
+/**
+ * A BusSubscriber for a CTHsm derived class C.  The event is always sent to
+ * the HSM.
+ */
+template<typename C, typename E>
+class HsmSubscriber : public BusSubscriber<E> {
+public:
+	HsmSubscriber(C* hsm) : _hsm(hsm) { };
+
+	virtual const void* hsm() const {
+		return _hsm;
+	};
+
+protected:
+	virtual bool deliver(E e) {
+		_hsm->sendEvent(e);
+		return true;
+	};
+
+	C* _hsm;
+};
+
+
+/**
+ * A BusSubscriber for a CTHsm derived class C, that only sends the event to
+ * the HSM while the HSM is in a particular state (that is, the state is
+ * current or is a parent of the current state.)
+ */
+template<typename C, typename E, typename S>
+class HsmStateSubscriber : public HsmSubscriber<C,E> {
+public:
+	HsmStateSubscriber(C* hsm, S state)
+		: HsmSubscriber<C,E>(hsm), _state(state) { };
+
+protected:
+	virtual bool deliver(E e) {
+		if (! this->_hsm->cthsmInState(_state))
+			return false;
+		this->_hsm->sendEvent(e);
+		return true;
+	};
+
+private:
+	S _state;
+};
+
+
+/**
+ * Publish events to the HSMs that have subscribed to them.
+ *
+ * Sending an event to every HSM and letting most of them bubble it up to
+ * their top state is slow when there are many HSMs.  Instead, HSMs can
+ * subscribe to the event numbers they care about, and an event is only sent
+ * to the subscribers for its event number.
+ *
+ * All the HSMs on one bus must use the same event type E, but they can be
+ * different classes.  Use SharedEvent as E so that large payloads are not
+ * copied for every subscriber.
+ *
+ * An EventBus is not thread safe.  Subscribing, unsubscribing and
+ * publishing must all be done from one thread, or under the caller's own
+ * lock.  Delivery to HSMs owned by other threads is done with a
+ * BusDispatcher.
+ */
+template<typename E>
+class EventBus {
+public:
+	typedef BusDispatcher<E> Dispatcher;
+	typedef BusSubscriber<E> Subscriber;
+
+	EventBus() : _publishing(0), _removed(false), _groups() { };
+
+	virtual ~EventBus() { };
+
+	/**
+	 * Subscribe an HSM to an event number.
+	 *
+	 * \arg hsm the HSM that will receive the events.
+	 * \arg event the event number.
+	 * \arg dispatcher if not 0, the dispatcher for the thread that owns
+	 * hsm.
+	 */
+	template<typename C>
+	void subscribe(C* hsm, int event, Dispatcher* dispatcher = 0) {
+		add(event, new HsmSubscriber<C,E>(hsm), dispatcher);
+	};
+
+	/**
+	 * Subscribe an HSM to an event number, but only while the HSM is in
+	 * a particular state.
+	 *
+	 * \arg hsm the HSM that will receive the events.
+	 * \arg event the event number.
+	 * \arg state the HSM only receives the event while in this state.
+	 * \arg dispatcher if not 0, the dispatcher for the thread that owns
+	 * hsm.
+	 */
+	template<typename C, typename S>
+	void subscribeInState(C* hsm, int event, S state,
+			      Dispatcher* dispatcher = 0) {
+		add(event, new HsmStateSubscriber<C,E,S>(hsm, state),
+		    dispatcher);
+	};
+
+	/**
+	 * Remove all the subscriptions for an HSM.  HSMs must be unsubscribed
+	 * before they are destroyed.  Events already handed to a dispatcher
+	 * are not delivered to the HSM after this, but an offer in progress
+	 * on another thread may still be running; see BusSubscriber.
+	 */
+	void unsubscribe(const void* hsm) {
+		typename Subscriptions::iterator it;
+		for (it = _subs.begin(); it != _subs.end(); it++) {
+			remove(it->second, hsm);
+		}
+		if (! _publishing && _removed)
+			compact();
+	};
+
+	/**
+	 * Remove the subscriptions for an HSM to one event number.
+	 */
+	void unsubscribe(const void* hsm, int event) {
+		typename Subscriptions::iterator it = _subs.find(event);
+		if (it != _subs.end())
+			remove(it->second, hsm);
+		if (! _publishing && _removed)
+			compact();
+	};
+
+	/**
+	 * Publish an event to all the HSMs that have subscribed to its event
+	 * number.
+	 *
+	 * Subscribers with no dispatcher are offered the event in this
+	 * thread, in the order in which they subscribed.  Subscribers with a
+	 * dispatcher are grouped by dispatcher, and each dispatcher is called
+	 * once.
+	 *
+	 * HSMs may publish, subscribe and unsubscribe from inside their state
+	 * functions.  A subscription added while an event is being published
+	 * does not receive that event.
+	 *
+	 * \return the number of subscribers that were sent the event, or for
+	 * subscribers with a dispatcher, the number the event was handed to.
+	 */
+	unsigned publish(E e) {
+		typename Subscriptions::iterator it = _subs.find(e.event());
+		if (it == _subs.end())
+			return 0;
+
+		// The outermost publish() reuses _groups, so the batches keep
+		// their capacity from one event to the next.  A publish() from
+		// inside a state function can't share them, and gets its own.
+		std::vector<Group> nested;
+		std::vector<Group>& groups = _publishing ? nested : _groups;
+		unsigned ngroups = 0;
+
+		_publishing++;
+		Entries& entries = it->second;
+		unsigned nentries = entries.size();
+		unsigned delivered = 0;
+		for (unsigned i = 0; i < nentries; i++) {
+			Entry& entry = entries[i];
+			if (! entry.subscriber->active())
+				continue;
+			if (! entry.dispatcher) {
+				if (entry.subscriber->offer(e))
+					delivered++;
+				continue;
+			}
+			groupFor(groups, ngroups, entry.dispatcher)
+				.batch.push_back(entry.subscriber);
+			delivered++;
+		}
+		for (unsigned g = 0; g < ngroups; g++) {
+			groups[g].dispatcher->dispatch(e, groups[g].batch);
+			groups[g].batch.clear();
+		}
+		_publishing--;
+
+		if (! _publishing && _removed)
+			compact();
+		return delivered;
+	};
+
+	/**
+	 * The number of subscriptions to an event number.
+	 */
+	unsigned subscribers(int event) {
+		typename Subscriptions::iterator it = _subs.find(event);
+		if (it == _subs.end())
+			return 0;
+		unsigned n = 0;
+		for (unsigned i = 0; i < it->second.size(); i++) {
+			if (it->second[i].subscriber->active())
+				n++;
+		}
+		return n;
+	};
+
+private:
+	struct Entry {
+		std::shared_ptr<Subscriber> subscriber;
+		Dispatcher* dispatcher;
+	};
+
+	typedef std::deque<Entry> Entries;
+	typedef std::map<int, Entries> Subscriptions;
+
+	/**
+	 * The subscribers that share a dispatcher, collected during one
+	 * publish().
+	 */
+	struct Group {
+		Dispatcher* dispatcher;
+		typename Dispatcher::Batch batch;
+	};
+
+	/**
+	 * Subscriptions, indexed by event number.
+	 */
+	Subscriptions _subs;
+
+	/**
+	 * The depth of nested calls to publish().  While we are publishing,
+	 * the lists are not compacted, so that publish() can keep walking
+	 * them, and so that no subscription is freed while its offer() is
+	 * running.
+	 */
+	unsigned _publishing;
+
+	/**
+	 * Set when subscriptions have been cancelled but not yet taken out
+	 * of the lists.
+	 */
+	bool _removed;
+
+	/**
+	 * The batches of the outermost publish().  Only the first few are in
+	 * use at a time; the rest are kept for their capacity.
+	 */
+	std::vector<Group> _groups;
+
+	void add(int event, Subscriber* subscriber, Dispatcher* dispatcher) {
+		Entry entry;
+		entry.subscriber.reset(subscriber);
+		entry.dispatcher = dispatcher;
+		_subs[event].push_back(entry);
+	};
+
+	/**
+	 * Cancel an HSM's subscriptions in one list.  They are freed by
+	 * compact(), once nothing is publishing and no dispatcher still holds
+	 * them.
+	 */
+	void remove(Entries& entries, const void* hsm) {
+		for (unsigned i = 0; i < entries.size(); i++) {
+			Subscriber* s = entries[i].subscriber.get();
+			if (s->active() && s->hsm() == hsm) {
+				s->cancel();
+				_removed = true;
+			}
+		}
+	};
+
+	/**
+	 * Take cancelled subscriptions out of the subscription lists.
+	 */
+	void compact() {
+		typename Subscriptions::iterator it = _subs.begin();
+		while (it != _subs.end()) {
+			Entries& entries = it->second;
+			Entries kept;
+			for (unsigned i = 0; i < entries.size(); i++) {
+				if (entries[i].subscriber->active())
+					kept.push_back(entries[i]);
+			}
+			entries.swap(kept);
+			if (entries.empty())
+				_subs.erase(it++);
+			else
+				it++;
+		}
+		_removed = false;
+	};
+
+	/**
+	 * Find the group for a dispatcher among the first ngroups, or start
+	 * a new one, reusing a group from an earlier publish() if there is
+	 * one.
+	 */
+	static Group& groupFor(std::vector<Group>& groups, unsigned& ngroups,
+			       Dispatcher* d) {
+		for (unsigned g = 0; g < ngroups; g++) {
+			if (groups[g].dispatcher == d)
+				return groups[g];
+		}
+		if (ngroups == groups.size())
+			groups.push_back(Group());
+		Group& group = groups[ngroups++];
+		group.dispatcher = d;
+		return group;
+	};
+};
+
+
+} // namespace CTHSM
+#endif /* __cthsm_bus_hh__*/
@@ -0,0 +1,247 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef __cthsm_channel_hh__
+#define __cthsm_channel_hh__
+
+#include "cthsm.hh"
+
+#include <atomic>
+#include <deque>
+#include <new>
+#include <cassert>
+
+/**
+ * The size of a cache line.  Things written by different threads are kept
+ * this far apart, so that the threads don't fight over cache lines.
+ */
+#ifndef CTHSM_CACHE_LINE
+#define CTHSM_CACHE_LINE 64
+#endif
+
+namespace CTHSM {
+
+
+/**
+ * A lock free channel carrying events from one thread to another.
+ *
+ * There must be exactly one producer thread, calling push() and flush(),
+ * and one consumer thread, calling pop().  With only one thread at each end
+ * there is no need for compare-and-swap; each end just publishes its own
+ * index into the ring buffer.
+ *
+ * Publishing is batched.  The producer makes its pushes visible to the
+ * consumer every BATCH pushes, or when it calls flush(), and the consumer
+ * releases the slots it has read once per call to pop().  So in a steady
+ * stream, the shared indices are written once per batch instead of once per
+ * event, and the cache line holding each index moves between cores much
+ * less often.
+ *
+ * The producer's and consumer's indices, and their private copies of each
+ * other's indices, are each on their own cache line.
+ *
+ * \arg E the event type.  It only needs to be copyable.
+ * \arg N the number of slots.  Must be a power of two.
+ * \arg BATCH publish after this many pushes, even without flush().
+ */
+template<typename E, unsigned N = 1024, unsigned BATCH = 32>
+class SpscChannel {
+public:
+	SpscChannel()
+		: _head(0), _tail(0),
+		  _ptail(0), _pheadCache(0), _unpublished(0),
+		  _chead(0), _ctailCache(0)
+	{
+		static_assert((N & (N - 1)) == 0, "N must be a power of two");
+		static_assert(BATCH <= N, "BATCH must be no bigger than N");
+	};
+
+	~SpscChannel() {
+		// Destroy events that were pushed but never popped.
+		unsigned long end = _ptail;
+		for (unsigned long i = _chead; i != end; i++)
+			slot(i)->~E();
+	};
+
+	/**
+	 * Add an event to the channel.  Producer only.
+	 *
+	 * The event is not visible to the consumer until BATCH events have
+	 * been pushed, or flush() is called.
+	 *
+	 * \return false if the channel is full.  The event is not added, and
+	 * any unpublished events are published.
+	 */
+	bool push(const E& e) {
+		if (_ptail - _pheadCache == N) {
+			_pheadCache = _head.load(std::memory_order_acquire);
+			if (_ptail - _pheadCache == N) {
+				flush();
+				return false;
+			}
+		}
+		new (slot(_ptail)) E(e);
+		_ptail++;
+		if (++_unpublished >= BATCH)
+			flush();
+		return true;
+	};
+
+	/**
+	 * Make all pushed events visible to the consumer.  Producer only.
+	 */
+	void flush() {
+		if (_unpublished) {
+			_tail.store(_ptail, std::memory_order_release);
+			_unpublished = 0;
+		}
+	};
+
+	/**
+	 * Take up to max events from the channel, calling f(e) for each one.
+	 * Consumer only.
+	 *
+	 * \return the number of events taken.
+	 */
+	template<typename F>
+	unsigned pop(F& f, unsigned max) {
+		unsigned n = 0;
+		while (n < max) {
+			if (_chead == _ctailCache) {
+				// Only look at the producer's index when we
+				// have used up what we saw last time.
+				_ctailCache =
+					_tail.load(std::memory_order_acquire);
+				if (_chead == _ctailCache)
+					break;
+			}
+			E* e = slot(_chead);
+			f(*e);
+			e->~E();
+			_chead++;
+			n++;
+		}
+		if (n)
+			_head.store(_chead, std::memory_order_release);
+		return n;
+	};
+
+	/**
+	 * \return true if the consumer would see no events.  This is only a
+	 * hint when called from the producer.
+	 */
+	bool empty() {
+		return _head.load(std::memory_order_acquire)
+			== _tail.load(std::memory_order_acquire);
+	};
+
+private:
+	E* slot(unsigned long i) {
+		return reinterpret_cast<E*>(_slots) + (i & (N - 1));
+	};
+
+	/**
+	 * Index of the next slot the consumer will read.  Written by the
+	 * consumer.
+	 */
+	alignas(CTHSM_CACHE_LINE) std::atomic<unsigned long> _head;
+
+	/**
+	 * Index of the next slot the producer will write, as last published.
+	 * Written by the producer.
+	 */
+	alignas(CTHSM_CACHE_LINE) std::atomic<unsigned long> _tail;
+
+	/** The producer's own tail, including unpublished events. */
+	alignas(CTHSM_CACHE_LINE) unsigned long _ptail;
+	/** The producer's last look at _head. */
+	unsigned long _pheadCache;
+	/** Events pushed since the last flush(). */
+	unsigned _unpublished;
+
+	/** The consumer's own head. */
+	alignas(CTHSM_CACHE_LINE) unsigned long _chead;
+	/** The consumer's last look at _tail. */
+	unsigned long _ctailCache;
+
+	alignas(CTHSM_CACHE_LINE) alignas(E)
+		unsigned char _slots[N * sizeof(E)];
+};
+
+
+/**
+ * The inbound channels of one HSM.
+ *
+ * When HSM A feeds HSM B on another thread, give each such pair its own
+ * SpscChannel.  B's thread then calls poll() in its loop, which takes
+ * events from each channel in turn, queues them on B, and runs B.
+ *
+ * Channels are polled round robin, starting one further along on each
+ * poll(), so a busy channel can't starve the others.
+ *
+ * \arg C the class of the destination HSM.
+ * \arg E its event type.
+ * \arg N, BATCH as for SpscChannel.
+ */
+template<typename C, typename E, unsigned N = 1024, unsigned BATCH = 32>
+class ChannelInbox {
+public:
+	typedef SpscChannel<E, N, BATCH> Channel;
+
+	ChannelInbox(C* hsm) : _hsm(hsm), _queue(hsm), _channels(), _next(0) { };
+
+	/**
+	 * Add an inbound channel.  The inbox does not own the channel.  This
+	 * must be done before the consumer thread starts polling.
+	 */
+	void add(Channel* channel) {
+		_channels.push_back(channel);
+	};
+
+	/**
+	 * Take up to batch events from each inbound channel, queue them on
+	 * the HSM, and run the HSM.
+	 *
+	 * \return the number of events taken from the channels.
+	 */
+	unsigned poll(unsigned batch = BATCH) {
+		unsigned n = 0;
+		unsigned nchannels = _channels.size();
+		for (unsigned i = 0; i < nchannels; i++) {
+			Channel* c = _channels[(_next + i) % nchannels];
+			n += c->pop(_queue, batch);
+		}
+		if (nchannels)
+			_next = (_next + 1) % nchannels;
+		if (n || _hsm->cthsmPending())
+			_hsm->cthsmRun();
+		return n;
+	};
+
+private:
+	/**
+	 * Queues each event SpscChannel::pop() hands it on the HSM.
+	 */
+	struct Queue {
+		Queue(C* hsm) : hsm(hsm) { };
+		void operator()(const E& e) {
+			hsm->cthsmQueueEvent(e);
+		};
+		C* hsm;
+	};
+
+	C* _hsm;
+	Queue _queue;
+	std::deque<Channel*> _channels;
+	unsigned _next;
+};
+
+
+} // namespace CTHSM
+#endif /* __cthsm_channel_hh__*/
@@ -0,0 +1,281 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef __cthsm_epoll_hh__
+#define __cthsm_epoll_hh__
+
+#include "cthsm_executor.hh"
+
+#include <iostream>
+#include <map>
+#include <vector>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+namespace CTHSM {
+
+
+/**
+ * Something an EpollExecutor is watching.  Each watch turns readiness on
+ * one file descriptor into an event for one HSM.
+ */
+class EpollWatch {
+public:
+	EpollWatch(int fd) : _fd(fd) { };
+
+	virtual ~EpollWatch() { };
+
+	/**
+	 * Queue an event for the HSM, because fd is ready.
+	 *
+	 * \arg revents the epoll events reported for fd.
+	 * \return the HSM, so the executor can schedule it.
+	 */
+	virtual Runnable* fire(uint32_t revents) = 0;
+
+	int fd() const {
+		return _fd;
+	};
+
+private:
+	int _fd;
+};
+
+
+/**
+ * An EpollWatch for a CTHsm derived class C.
+ *
+ * F is a function or function object called as f(fd, revents), that
+ * returns the event to queue on the HSM.
+ */
+template<typename C, typename F>
+class HsmEpollWatch : public EpollWatch {
+public:
+	HsmEpollWatch(int fd, C* hsm, F make)
+		: EpollWatch(fd), _hsm(hsm), _make(make) { };
+
+	virtual Runnable* fire(uint32_t revents) {
+		_hsm->cthsmQueueEvent(_make(fd(), revents));
+		return _hsm;
+	};
+
+private:
+	C* _hsm;
+	F _make;
+};
+
+
+/**
+ * An Executor that waits for file descriptors with Linux epoll.
+ *
+ * Each pass of the loop makes one epoll_wait() call.  Every file descriptor
+ * that is ready has an event queued on its HSM, and then every HSM with
+ * queued events gets one turn with CTHsm::cthsmRun().  So a single wakeup
+ * can feed many events to many HSMs, and each HSM handles all the events
+ * from one wakeup in one go, instead of the I/O callback dispatching each
+ * event as it arrives.
+ *
+ * If any HSM still has events after its turn (because it ran out of
+ * budget), the next epoll_wait() does not block, so that HSM gets another
+ * turn straight after any new I/O has been collected.
+ *
+ * Watches are level triggered unless EPOLLET is given.  A level triggered
+ * file descriptor fires on every pass for as long as it is ready, so until
+ * the HSM has read everything from it, each pass queues another event.
+ * That includes the passes that don't block because some HSM still has
+ * events, so an HSM that reads a little at a time gets a steady stream of
+ * duplicate events.  Read until EAGAIN in one turn, or watch with EPOLLET
+ * or EPOLLONESHOT, to avoid that.
+ *
+ * An EpollExecutor must only be used from one thread, except for stop().
+ */
+class EpollExecutor : public Executor {
+public:
+	/**
+	 * If the epoll or eventfd descriptors can't be made, the problem is
+	 * reported on std::cerr and the program is aborted, in all builds, as
+	 * CTHsm::cthsmStart() does for a broken hierarchy.
+	 *
+	 * \arg maxEvents the most file descriptors collected by one call to
+	 * epoll_wait().
+	 */
+	EpollExecutor(unsigned maxEvents = 64)
+		: _epfd(epoll_create1(EPOLL_CLOEXEC)),
+		  _stopfd(-1),
+		  _evs(maxEvents),
+		  _stopped(false),
+		  _error(0),
+		  _watches()
+	{
+		if (_epfd < 0)
+			fail("epoll_create1");
+		_stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (_stopfd < 0)
+			fail("eventfd");
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = 0;
+		if (epoll_ctl(_epfd, EPOLL_CTL_ADD, _stopfd, &ev) < 0)
+			fail("epoll_ctl");
+	};
+
+	virtual ~EpollExecutor() {
+		std::map<int, EpollWatch*>::iterator it;
+		for (it = _watches.begin(); it != _watches.end(); it++)
+			delete it->second;
+		close(_stopfd);
+		close(_epfd);
+	};
+
+	/**
+	 * Watch a file descriptor.  When epoll reports fd as ready, make(fd,
+	 * revents) is called, the event it returns is queued on hsm, and hsm
+	 * is scheduled.
+	 *
+	 * \arg fd the file descriptor.  Only one watch per file descriptor
+	 * is allowed.
+	 * \arg events the epoll events to wait for, such as EPOLLIN.
+	 * \arg hsm the HSM to get the events.
+	 * \arg make makes the event.
+	 * \return true if epoll accepted fd.
+	 */
+	template<typename C, typename F>
+	bool watch(int fd, uint32_t events, C* hsm, F make) {
+		assert( _watches.find(fd) == _watches.end() );
+
+		EpollWatch* w = new HsmEpollWatch<C,F>(fd, hsm, make);
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.ptr = w;
+		if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			delete w;
+			return false;
+		}
+		_watches[fd] = w;
+		return true;
+	};
+
+	/**
+	 * Stop watching a file descriptor.  This must be done before fd is
+	 * closed.
+	 */
+	void unwatch(int fd) {
+		std::map<int, EpollWatch*>::iterator it = _watches.find(fd);
+		if (it == _watches.end())
+			return;
+		epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, 0);
+		delete it->second;
+		_watches.erase(it);
+	};
+
+	/**
+	 * Run until stop() is called, or until epoll_wait() fails.  After a
+	 * failure, error() says why.
+	 */
+	virtual void run() {
+		while (! _stopped)
+			runOnce(-1);
+		_stopped = false;
+	};
+
+	virtual void stop() {
+		uint64_t one = 1;
+		ssize_t n = write(_stopfd, &one, sizeof(one));
+		(void)n;
+	};
+
+	/**
+	 * Do one pass of the loop: wait for file descriptors, queue events
+	 * for the ones that are ready, then give each scheduled HSM a turn.
+	 *
+	 * \arg timeout the most milliseconds to wait, or -1 to wait forever.
+	 * If any HSMs are still scheduled from the last pass, we don't wait.
+	 * \return the number of file descriptors that were ready, not
+	 * counting the one used by stop(), or -1 if epoll_wait() failed.  A
+	 * failure also makes run() return, and error() has its errno.
+	 */
+	int runOnce(int timeout) {
+		if (ready())
+			timeout = 0;
+		int n = epoll_wait(_epfd, _evs.data(), _evs.size(), timeout);
+		if (n < 0) {
+			if (errno != EINTR) {
+				_error = errno;
+				_stopped = true;
+				return -1;
+			}
+			n = 0;
+		}
+		int fds = 0;
+		for (int i = 0; i < n; i++) {
+			EpollWatch* w =
+				static_cast<EpollWatch*>(_evs[i].data.ptr);
+			if (! w) {
+				uint64_t count;
+				ssize_t r;
+				r = read(_stopfd, &count, sizeof(count));
+				(void)r;
+				_stopped = true;
+				continue;
+			}
+			schedule(w->fire(_evs[i].events));
+			fds++;
+		}
+		runReady();
+		return fds;
+	};
+
+	/**
+	 * \return the errno of the last failed epoll_wait(), or 0.
+	 */
+	int error() const {
+		return _error;
+	};
+
+private:
+	static void fail(const char* what) {
+		std::cerr << "EpollExecutor: " << what << ": " << strerror(errno)
+			  << "\n";
+		std::abort();
+	};
+
+	int _epfd;
+
+	/**
+	 * An eventfd written by stop(), to wake up epoll_wait().
+	 */
+	int _stopfd;
+
+	/**
+	 * Filled in by epoll_wait().
+	 */
+	std::vector<struct epoll_event> _evs;
+
+	bool _stopped;
+
+	/**
+	 * Set by runOnce() when epoll_wait() fails.
+	 */
+	int _error;
+
+	/**
+	 * Watches, indexed by file descriptor.
+	 */
+	std::map<int, EpollWatch*> _watches;
+};
+
+
+} // namespace CTHSM
+#endif /* __cthsm_epoll_hh__*/
@@ -0,0 +1,124 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef __cthsm_executor_hh__
+#define __cthsm_executor_hh__
+
+#include "cthsm.hh"
+
+#include <deque>
+#include <unordered_set>
+
+namespace CTHSM {
+
+
+/**
+ * Runs the event loops of many HSMs.
+ *
+ * Something (an I/O readiness notification, a timer, another HSM) queues
+ * events on an HSM with CTHsm::cthsmQueueEvent(), and then tells the
+ * executor about that HSM with schedule().  The executor runs each scheduled
+ * HSM with CTHsm::cthsmRun(), so all the events queued for one HSM are
+ * handled in one go, within that HSM's budget (see CTHsm::cthsmSetBudget().)
+ *
+ * HSMs that still have events after their turn are run again on the next
+ * pass, after every other scheduled HSM has had its turn.
+ *
+ * Derived executors provide the thing that waits for work (epoll, for
+ * instance) by implementing run() and stop().
+ */
+class Executor {
+public:
+	Executor() : _ready(), _scheduled() { };
+
+	virtual ~Executor() { };
+
+	/**
+	 * Run the executor until stop() is called.
+	 */
+	virtual void run() = 0;
+
+	/**
+	 * Make run() return.  This may be called from any thread.
+	 */
+	virtual void stop() = 0;
+
+	/**
+	 * Tell the executor that an HSM has events to handle.  Scheduling an
+	 * HSM that is already scheduled does nothing, so it is fine to call
+	 * this once for every event queued.
+	 *
+	 * This must be called from the executor's thread.
+	 */
+	void schedule(Runnable* r) {
+		if (_scheduled.insert(r).second)
+			_ready.push_back(r);
+	};
+
+	/**
+	 * Forget about an HSM.  Call this before destroying an HSM that may
+	 * be scheduled.
+	 */
+	void unschedule(Runnable* r) {
+		if (_scheduled.erase(r)) {
+			std::deque<Runnable*>::iterator it;
+			for (it = _ready.begin(); it != _ready.end(); it++) {
+				if (*it == r) {
+					_ready.erase(it);
+					break;
+				}
+			}
+		}
+	};
+
+	/**
+	 * \return true if any HSM has been scheduled but has not yet
+	 * finished handling its events.
+	 */
+	bool ready() {
+		return _ready.size() != 0;
+	};
+
+protected:
+	/**
+	 * Give every scheduled HSM one turn.  HSMs that are scheduled while
+	 * this is running (by the HSMs being run, perhaps) wait for the next
+	 * pass.
+	 *
+	 * \return the number of HSMs that were run.
+	 */
+	unsigned runReady() {
+		unsigned n = _ready.size();
+		for (unsigned i = 0; i < n && _ready.size(); i++) {
+			Runnable* r = _ready.front();
+			_ready.pop_front();
+			if (r->cthsmRun())
+				_ready.push_back(r);
+			else
+				_scheduled.erase(r);
+		}
+		return n;
+	};
+
+private:
+	/**
+	 * HSMs waiting for their turn, in the order they will get it.
+	 */
+	std::deque<Runnable*> _ready;
+
+	/**
+	 * The same HSMs as _ready, so that schedule() can quickly tell if an
+	 * HSM is already waiting.
+	 */
+	std::unordered_set<Runnable*> _scheduled;
+};
+
+
+} // namespace CTHSM
+#endif /* __cthsm_executor_hh__*/
@@ -0,0 +1,169 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef __cthsm_fleet_hh__
+#define __cthsm_fleet_hh__
+
+#include "cthsm.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CTHSM {
+
+
+/**
+ * Sends events to large numbers of HSMs, in parallel.
+ *
+ * sendEvent() splits the HSMs into chunks, and each chunk is given to
+ * CTHsm::cthsmBulkSend() on one of a fixed set of worker threads (or on the
+ * calling thread, which also takes chunks.)  Each chunk finds the paths of
+ * its own transitions.  sendEvent() returns when every chunk is done.
+ *
+ * Because chunks run at the same time, the HSMs must not share anything
+ * that their state functions and actions change, and no HSM may appear
+ * twice in one sendEvent().
+ *
+ * sendEvent() may be called from several threads, but the workers do one
+ * sendEvent() at a time, so the calls take turns.
+ *
+ * \arg C the HSM class.
+ * \arg E its event type.
+ */
+template<typename C, typename E>
+class Fleet {
+public:
+	/**
+	 * \arg threads the number of worker threads, besides the calling
+	 * thread.  With none, sendEvent() is just CTHsm::cthsmBulkSend().
+	 * \arg chunk the number of HSMs in each chunk.
+	 */
+	Fleet(unsigned threads = 0, size_t chunk = 1024)
+		: _chunk(chunk ? chunk : 1), _workers(), _mutex(), _wake(),
+		  _idle(), _sending(), _job(0), _generation(0), _quit(false)
+	{
+		for (unsigned i = 0; i < threads; i++)
+			_workers.push_back(std::thread([this]() { worker(); }));
+	};
+
+	~Fleet() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_quit = true;
+		}
+		_wake.notify_all();
+		for (unsigned i = 0; i < _workers.size(); i++)
+			_workers[i].join();
+	};
+
+	/**
+	 * Send e to every HSM in hsms.  See CTHsm::cthsmBulkSend().
+	 */
+	void sendEvent(const std::vector<C*>& hsms, E e) {
+		sendEvent(hsms.size() ? &hsms[0] : 0, hsms.size(), e);
+	};
+
+	void sendEvent(C* const* hsms, size_t n, E e) {
+		if (_workers.empty() || n <= _chunk) {
+			C::cthsmBulkSend(hsms, n, e);
+			return;
+		}
+
+		std::lock_guard<std::mutex> sending(_sending);
+		Job job(hsms, n, e, (n + _chunk - 1) / _chunk);
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_job = &job;
+			_generation++;
+		}
+		_wake.notify_all();
+		run(job);
+
+		// Every chunk has been taken.  Wait for the workers that took
+		// them, and make sure no other worker picks this job up.
+		std::unique_lock<std::mutex> lock(_mutex);
+		_job = 0;
+		while (job.active)
+			_idle.wait(lock);
+	};
+
+private:
+	/**
+	 * One sendEvent().
+	 */
+	struct Job {
+		Job(C* const* hsms, size_t n, const E& e, size_t chunks)
+			: hsms(hsms), n(n), e(e), chunks(chunks), next(0),
+			  active(0) { };
+
+		C* const* hsms;
+		size_t n;
+		E e;
+		size_t chunks;
+		/** The next chunk to take. */
+		std::atomic<size_t> next;
+		/** Workers inside run() for this job.  Guarded by _mutex. */
+		unsigned active;
+	};
+
+	/**
+	 * Take chunks of job until there are none left.
+	 */
+	void run(Job& job) {
+		size_t c;
+		while ((c = job.next.fetch_add(1)) < job.chunks) {
+			size_t from = c * _chunk;
+			size_t count = job.n - from;
+			if (count > _chunk)
+				count = _chunk;
+			C::cthsmBulkSend(job.hsms + from, count, job.e);
+		}
+	};
+
+	void worker() {
+		unsigned long seen = 0;
+		std::unique_lock<std::mutex> lock(_mutex);
+		for (;;) {
+			while (! _quit && ! (_job && _generation != seen))
+				_wake.wait(lock);
+			if (_quit)
+				return;
+			seen = _generation;
+			Job* job = _job;
+			job->active++;
+			lock.unlock();
+			run(*job);
+			lock.lock();
+			if (--job->active == 0)
+				_idle.notify_all();
+		}
+	};
+
+	size_t _chunk;
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	/** Tells workers there is a new job, or that they should quit. */
+	std::condition_variable _wake;
+	/** Tells sendEvent() that the last worker has left its job. */
+	std::condition_variable _idle;
+	/** Held by sendEvent() while the workers run its job. */
+	std::mutex _sending;
+	/** The current job, or 0. */
+	Job* _job;
+	/** Counts jobs, so a worker takes each job at most once. */
+	unsigned long _generation;
+	bool _quit;
+};
+
+
+} // namespace CTHSM
+#endif /* __cthsm_fleet_hh__*/
@@ -0,0 +1,344 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef __cthsm_profile_hh__
+#define __cthsm_profile_hh__
+
+/*
+ * This file is included by cthsm.hh when CTHSM_PROFILE is defined.  There is
+ * no need to include it directly.
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Time only one in this many dispatches and transitions.  The counts of
+ * calls, parent queries, exits and entries are always exact, but reading
+ * the clock is the most expensive part of profiling, so it can be sampled.
+ *
+ * Only the timing is sampled.  Every dispatch and every transition still
+ * looks up and updates its entry in the HSM's profile maps, so a profiled
+ * HSM is slower than an unprofiled one whatever the sample rate.
+ */
+#ifndef CTHSM_PROFILE_SAMPLE
+#define CTHSM_PROFILE_SAMPLE 1
+#endif
+
+namespace CTHSM {
+
+
+/**
+ * A cheap, increasing clock for profiling.  This is the CPU cycle counter
+ * where we have one, and nanoseconds otherwise.
+ */
+inline unsigned long long profileCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+/**
+ * Counts of where an HSM spends its time.
+ *
+ * CTHsm keeps one of these when compiled with CTHSM_PROFILE, and calls it
+ * around each event dispatch (keyed by the current state and the event
+ * number) and each transition (keyed by the source and destination states.)
+ *
+ * S is the HSM's State type.
+ */
+template<typename S>
+class Profile {
+public:
+	/**
+	 * Figures common to dispatches and transitions.
+	 */
+	struct Counts {
+		Counts() : count(0), timed(0), cycles(0) { };
+
+		/** Number of calls. */
+		unsigned long count;
+		/** Number of calls that were timed. */
+		unsigned long timed;
+		/** Total cycles spent in the timed calls. */
+		unsigned long long cycles;
+
+		/**
+		 * Estimated total cycles for all the calls, from the sampled
+		 * ones.
+		 */
+		unsigned long long estimated() const {
+			if (! timed)
+				return 0;
+			return cycles / timed * count;
+		};
+	};
+
+	/**
+	 * Figures for one (src,dst) transition.
+	 */
+	struct Transition : public Counts {
+		Transition() : parents(0), exits(0), entries(0) { };
+
+		/** Total CTHE_PARENT queries made to find the path. */
+		unsigned long parents;
+		/** Total exit actions called. */
+		unsigned long exits;
+		/** Total entry actions called. */
+		unsigned long entries;
+	};
+
+	/**
+	 * Figures for one (state,event) dispatch.
+	 */
+	struct Dispatch : public Counts {
+		Dispatch() : bubbles(0) { };
+
+		/**
+		 * Total times the event was passed up to a parent state
+		 * before it was handled.
+		 */
+		unsigned long bubbles;
+	};
+
+	Profile() : _parents(0), _exits(0), _entries(0), _sample(0),
+		    _timeDispatch(false), _timeTransition(false) { };
+
+	/**
+	 * Give a state a name for report().
+	 */
+	void name(S s, const char* n) {
+		_names[key(s)] = n;
+	};
+
+	/** Called for every CTHE_PARENT sent to a state. */
+	void parentQuery() {
+		_parents++;
+	};
+
+	/** Called for every CTHE_EXIT sent to a state. */
+	void exitAction() {
+		_exits++;
+	};
+
+	/** Called for every CTHE_ENTRY sent to a state. */
+	void entryAction() {
+		_entries++;
+	};
+
+	void dispatchBegin() {
+		_bubbles = 0;
+		_timeDispatch = sample();
+		if (_timeDispatch)
+			_dispatchStart = profileCycles();
+	};
+
+	/** Called when the event is passed up to a parent state. */
+	void bubble() {
+		_bubbles++;
+	};
+
+	void dispatchEnd(S state, int event) {
+		Dispatch& d = _dispatches[std::make_pair(key(state), event)];
+		d.count++;
+		d.bubbles += _bubbles;
+		if (_timeDispatch) {
+			d.timed++;
+			d.cycles += profileCycles() - _dispatchStart;
+		}
+	};
+
+	void transitionBegin() {
+		_parents0 = _parents;
+		_exits0 = _exits;
+		_entries0 = _entries;
+		_timeTransition = sample();
+		if (_timeTransition)
+			_transitionStart = profileCycles();
+	};
+
+	void transitionEnd(S src, S dst) {
+		unsigned long long end = 0;
+		if (_timeTransition)
+			end = profileCycles();
+		Transition& t = _transitions[std::make_pair(key(src),
+							    key(dst))];
+		t.count++;
+		t.parents += _parents - _parents0;
+		t.exits += _exits - _exits0;
+		t.entries += _entries - _entries0;
+		if (_timeTransition) {
+			t.timed++;
+			t.cycles += end - _transitionStart;
+		}
+	};
+
+	/**
+	 * Get the figures for a transition, or 0 if it has not happened.
+	 */
+	const Transition* transition(S src, S dst) const {
+		typename Transitions::const_iterator it =
+			_transitions.find(std::make_pair(key(src), key(dst)));
+		return it == _transitions.end() ? 0 : &it->second;
+	};
+
+	/**
+	 * Get the figures for an event dispatched while in a state, or 0 if
+	 * that has not happened.
+	 */
+	const Dispatch* dispatch(S state, int event) const {
+		typename Dispatches::const_iterator it =
+			_dispatches.find(std::make_pair(key(state), event));
+		return it == _dispatches.end() ? 0 : &it->second;
+	};
+
+	/**
+	 * Write the hot-path report: transitions and dispatches, each sorted
+	 * with the most expensive first.  Per-call figures are averages.
+	 */
+	void report(std::ostream& out) const {
+		std::vector<const typename Transitions::value_type*> ts;
+		typename Transitions::const_iterator tit;
+		for (tit = _transitions.begin(); tit != _transitions.end();
+		     tit++)
+			ts.push_back(&*tit);
+		std::sort(ts.begin(), ts.end(), hotter<Transitions>);
+
+		out << "CTHsm profile: transitions\n";
+		out << std::setw(10) << "count"
+		    << std::setw(14) << "est.cycles"
+		    << std::setw(10) << "cyc/call"
+		    << std::setw(8) << "parents"
+		    << std::setw(6) << "exits"
+		    << std::setw(8) << "entries"
+		    << "  src -> dst\n";
+		for (unsigned i = 0; i < ts.size(); i++) {
+			const Transition& t = ts[i]->second;
+			line(out, t);
+			out << std::setw(8) << t.parents / t.count
+			    << std::setw(6) << t.exits / t.count
+			    << std::setw(8) << t.entries / t.count
+			    << "  " << nameOf(ts[i]->first.first)
+			    << " -> " << nameOf(ts[i]->first.second) << "\n";
+		}
+
+		std::vector<const typename Dispatches::value_type*> ds;
+		typename Dispatches::const_iterator dit;
+		for (dit = _dispatches.begin(); dit != _dispatches.end(); dit++)
+			ds.push_back(&*dit);
+		std::sort(ds.begin(), ds.end(), hotter<Dispatches>);
+
+		out << "CTHsm profile: dispatches\n";
+		out << std::setw(10) << "count"
+		    << std::setw(14) << "est.cycles"
+		    << std::setw(10) << "cyc/call"
+		    << std::setw(8) << "bubbles"
+		    << "  state event\n";
+		for (unsigned i = 0; i < ds.size(); i++) {
+			const Dispatch& d = ds[i]->second;
+			line(out, d);
+			out << std::setw(8) << d.bubbles / d.count
+			    << "  " << nameOf(ds[i]->first.first)
+			    << " " << ds[i]->first.second << "\n";
+		}
+	};
+
+private:
+	/**
+	 * States are pointers to member functions, which can't be ordered,
+	 * so we use their bytes as map keys.
+	 */
+	typedef std::array<unsigned char, sizeof(S)> Key;
+
+	typedef std::map<std::pair<Key,Key>, Transition> Transitions;
+	typedef std::map<std::pair<Key,int>, Dispatch> Dispatches;
+
+	static Key key(S s) {
+		Key k;
+		std::memcpy(&k[0], &s, sizeof(S));
+		return k;
+	};
+
+	template<typename M>
+	static bool hotter(const typename M::value_type* a,
+			   const typename M::value_type* b) {
+		if (a->second.estimated() != b->second.estimated())
+			return a->second.estimated() > b->second.estimated();
+		return a->second.count > b->second.count;
+	};
+
+	static void line(std::ostream& out, const Counts& c) {
+		out << std::setw(10) << c.count
+		    << std::setw(14) << c.estimated()
+		    << std::setw(10) << (c.timed ? c.cycles / c.timed : 0);
+	};
+
+	/**
+	 * The name given to a state, or else the address of its function,
+	 * which can be looked up with addr2line.
+	 */
+	std::string nameOf(const Key& k) const {
+		typename std::map<Key, std::string>::const_iterator it =
+			_names.find(k);
+		if (it != _names.end())
+			return it->second;
+		void* p;
+		std::memcpy(&p, &k[0], sizeof(p));
+		std::ostringstream s;
+		s << p;
+		return s.str();
+	};
+
+	/** Decide whether to time this call. */
+	bool sample() {
+		if (++_sample < CTHSM_PROFILE_SAMPLE)
+			return false;
+		_sample = 0;
+		return true;
+	};
+
+	Transitions _transitions;
+	Dispatches _dispatches;
+	std::map<Key, std::string> _names;
+
+	/** Running totals of framework events sent to states. */
+	unsigned long _parents, _exits, _entries;
+	/** Totals at the start of the current transition. */
+	unsigned long _parents0, _exits0, _entries0;
+	/** Bubbles in the current dispatch. */
+	unsigned long _bubbles;
+
+	unsigned _sample;
+	bool _timeDispatch;
+	bool _timeTransition;
+	unsigned long long _dispatchStart;
+	unsigned long long _transitionStart;
+};
+
+
+} // namespace CTHSM
+#endif /* __cthsm_profile_hh__*/
@@ -0,0 +1,570 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef __cthsm_shard_hh__
+#define __cthsm_shard_hh__
+
+#include "cthsm_channel.hh"
+#include "cthsm_executor.hh"
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+namespace CTHSM {
+
+
+/**
+ * Memory for the HSMs of one shard.
+ *
+ * Memory is taken from the system in large blocks, and handed out in
+ * multiples of CTHSM_CACHE_LINE, aligned to CTHSM_CACHE_LINE, so no two HSMs
+ * share a cache line.  Freed memory is kept on a free list for its size and
+ * reused for the next allocation of that size.  Nothing is returned to the
+ * system until the arena is destroyed.
+ *
+ * An arena must only be used by one thread.  Blocks are allocated, and so
+ * first touched, by that thread, so with Linux's default first touch policy
+ * they come from that thread's NUMA node.
+ */
+class ShardArena {
+public:
+	ShardArena(size_t blockSize = 1 << 20)
+		: _blockSize(blockSize), _blocks(), _next(0), _end(0), _free()
+	{ };
+
+	~ShardArena() {
+		for (unsigned i = 0; i < _blocks.size(); i++)
+			free(_blocks[i]);
+	};
+
+	/**
+	 * \return memory for size bytes, aligned to CTHSM_CACHE_LINE.
+	 */
+	void* allocate(size_t size) {
+		size = round(size);
+		std::unordered_map<size_t, void*>::iterator it =
+			_free.find(size);
+		if (it != _free.end() && it->second) {
+			void* p = it->second;
+			it->second = *static_cast<void**>(p);
+			return p;
+		}
+		if (size > _blockSize)
+			return block(size);
+		if (_next + size > _end) {
+			_next = static_cast<char*>(block(_blockSize));
+			_end = _next + _blockSize;
+		}
+		void* p = _next;
+		_next += size;
+		return p;
+	};
+
+	/**
+	 * Give back memory from allocate().  size must be the size that was
+	 * allocated.
+	 */
+	void release(void* p, size_t size) {
+		void*& head = _free[round(size)];
+		*static_cast<void**>(p) = head;
+		head = p;
+	};
+
+private:
+	static size_t round(size_t size) {
+		if (size < sizeof(void*))
+			size = sizeof(void*);
+		return (size + CTHSM_CACHE_LINE - 1)
+			& ~size_t(CTHSM_CACHE_LINE - 1);
+	};
+
+	void* block(size_t size) {
+		void* p;
+		if (posix_memalign(&p, CTHSM_CACHE_LINE, size))
+			throw std::bad_alloc();
+		_blocks.push_back(p);
+		return p;
+	};
+
+	size_t _blockSize;
+	std::vector<void*> _blocks;
+	/** The unused part of the current block. */
+	char* _next;
+	char* _end;
+	/** Free lists, by rounded size, linked through the freed memory. */
+	std::unordered_map<size_t, void*> _free;
+};
+
+
+/**
+ * An event on its way to the HSM with a key.
+ */
+template<typename E>
+struct Envelope {
+	Envelope(unsigned long key, const E& e) : key(key), event(e) { };
+	unsigned long key;
+	E event;
+};
+
+
+/**
+ * Runs many keyed HSMs of class C on a fixed set of threads, with no
+ * sharing between threads.
+ *
+ * Each thread owns one shard.  Each HSM belongs to the shard chosen by a
+ * hash of its key, and is created, run and destroyed only by that shard's
+ * thread, in memory from that shard's ShardArena.  HSMs are created by the
+ * first event sent to their key.
+ *
+ * send() delivers an event to the HSM with a key, from any shard thread or
+ * from one outside thread:
+ *
+ * - from the HSM's own shard, the event is queued on the HSM straight
+ *   away;
+ *
+ * - from another shard, or from the outside thread, it goes through a
+ *   lock free SpscChannel.  Every pair of shards has its own channel (as
+ *   does the outside thread with each shard), so channels never have more
+ *   than one producer.  Channels are allocated by the receiving shard's
+ *   thread.
+ *
+ * Each shard is an Executor.  Its loop takes events from its channels,
+ * queues them on their HSMs, gives every HSM with events one
+ * CTHsm::cthsmRun(), and publishes whatever its HSMs sent to other shards.
+ * Shards poll; they do not sleep while there is no work.
+ *
+ * Events sent from the outside thread are only published every BATCH
+ * events, or by flush().
+ *
+ * There is no BusDispatcher for shards.  EventBus subscriptions hold HSM
+ * pointers, and a sharded HSM can be retired and made again at any time, so
+ * bus events for sharded HSMs should be passed on with send() and a key.
+ *
+ * \arg C the HSM class.
+ * \arg E its event type.
+ * \arg N, BATCH as for SpscChannel.
+ */
+template<typename C, typename E, unsigned N = 1024, unsigned BATCH = 32>
+class ShardedRuntime {
+public:
+	typedef SpscChannel<Envelope<E>, N, BATCH> Channel;
+
+	/**
+	 * Makes the HSM for a key, in the memory given.
+	 */
+	typedef std::function<C*(void* mem, unsigned long key)> Factory;
+
+	/**
+	 * \arg nshards the number of shards, and threads.
+	 * \arg factory makes each HSM.  If empty, HSMs are made with C(key).
+	 * \arg pin if true, pin shard i's thread to CPU i (modulo the number
+	 * of CPUs) with pthread_setaffinity_np().
+	 */
+	ShardedRuntime(unsigned nshards, Factory factory = Factory(),
+		       bool pin = false)
+		: _factory(factory ? factory : Factory(defaultFactory)),
+		  _pin(pin), _cpus(), _shards(), _threads(),
+		  _started(0), _stopped(false)
+	{
+		assert( nshards );
+		for (unsigned i = 0; i < nshards; i++)
+			_shards.push_back(new Shard(this, i));
+	};
+
+	~ShardedRuntime() {
+		stop();
+		for (unsigned i = 0; i < _shards.size(); i++)
+			delete _shards[i];
+	};
+
+	/**
+	 * Pin shard threads to these CPUs instead, shard i to
+	 * cpus[i % cpus.size()].  Call before start().
+	 */
+	void pinTo(const std::vector<int>& cpus) {
+		_cpus = cpus;
+		_pin = true;
+	};
+
+	unsigned shards() const {
+		return _shards.size();
+	};
+
+	/**
+	 * \return the shard that owns key.
+	 */
+	unsigned shardOf(unsigned long key) const {
+		// A 64 bit mix, so that sequential keys spread evenly.
+		unsigned long long h = key;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return h % _shards.size();
+	};
+
+	/**
+	 * Start the shard threads.  Returns when every shard is ready to
+	 * receive events.
+	 */
+	void start() {
+		unsigned n = _shards.size();
+		for (unsigned i = 0; i < n; i++) {
+			Shard* s = _shards[i];
+			_threads.push_back(std::thread([this, s]() {
+				threadMain(s);
+			}));
+		}
+		while (_started.load(std::memory_order_acquire) < n)
+			std::this_thread::yield();
+	};
+
+	/**
+	 * Stop and join the shard threads.  Before it exits, each shard's
+	 * thread destroys its HSMs.  Events not yet taken from the channels
+	 * are dropped, and so is every event sent from now on, including
+	 * those sent by exit actions as the HSMs are destroyed.  A stopped
+	 * runtime can't be started again.
+	 */
+	void stop() {
+		_stopped.store(true, std::memory_order_relaxed);
+		for (unsigned i = 0; i < _shards.size(); i++)
+			_shards[i]->stop();
+		for (unsigned i = 0; i < _threads.size(); i++)
+			_threads[i].join();
+		_threads.clear();
+	};
+
+	/**
+	 * Send an event to the HSM with key.  Call this from a shard thread
+	 * (from a state function, for instance) or from the one outside
+	 * thread, after start().
+	 */
+	void send(unsigned long key, const E& e) {
+		assert( _started.load(std::memory_order_relaxed)
+			== _shards.size() );
+		if (stopped())
+			return;
+		unsigned to = shardOf(key);
+		Shard* from = _current;
+		if (from && from->runtime() == this) {
+			if (from->index() == to)
+				from->deliver(key, e);
+			else
+				from->post(_shards[to]->inbox(from->index()),
+					   Envelope<E>(key, e));
+		} else {
+			Channel* c = _shards[to]->inbox(_shards.size());
+			while (! c->push(Envelope<E>(key, e))) {
+				if (stopped())
+					return;
+				std::this_thread::yield();
+			}
+		}
+	};
+
+	/**
+	 * Publish the events sent from the outside thread.
+	 */
+	void flush() {
+		for (unsigned i = 0; i < _shards.size(); i++)
+			_shards[i]->inbox(_shards.size())->flush();
+	};
+
+	/**
+	 * Retire the HSM with key: it is destroyed after its current turn.
+	 * Call this only from the HSM's own shard thread.  Events still
+	 * queued on the HSM after that turn are dropped, and a later event for
+	 * the key makes a new HSM.
+	 */
+	void retire(unsigned long key) {
+		assert( _current && _current->runtime() == this );
+		assert( _current->index() == shardOf(key) );
+		_current->retire(key);
+	};
+
+	/**
+	 * \return the HSM with key, or 0 if there isn't one.  Only safe on
+	 * the key's shard thread.
+	 */
+	C* find(unsigned long key) {
+		return _shards[shardOf(key)]->find(key);
+	};
+
+private:
+	bool stopped() const {
+		return _stopped.load(std::memory_order_relaxed);
+	};
+
+	static C* defaultFactory(void* mem, unsigned long key) {
+		return new (mem) C(key);
+	};
+
+	/**
+	 * One shard: its HSMs, its arena, and its inbound channels.
+	 */
+	class Shard : public Executor {
+	public:
+		Shard(ShardedRuntime* runtime, unsigned index)
+			: _runtime(runtime), _index(index), _arena(),
+			  _machines(), _building(), _retired(), _inbox(),
+			  _outbox(), _stop(false)
+		{ };
+
+		/**
+		 * The HSMs have already been destroyed by run(), on the
+		 * shard's own thread.
+		 */
+		~Shard() {
+			for (unsigned i = 0; i < _inbox.size(); i++)
+				delete _inbox[i];
+		};
+
+		ShardedRuntime* runtime() const {
+			return _runtime;
+		};
+
+		unsigned index() const {
+			return _index;
+		};
+
+		/**
+		 * Allocate the inbound channels.  Called on the shard's
+		 * own thread, so they are local to it.  There is one from
+		 * each other shard and one, last, from the outside thread.
+		 */
+		void open(unsigned nshards) {
+			for (unsigned i = 0; i <= nshards; i++)
+				_inbox.push_back(i == _index ? 0 : new Channel);
+			_outbox.resize(nshards, 0);
+		};
+
+		Channel* inbox(unsigned from) {
+			return _inbox[from];
+		};
+
+		/**
+		 * Push an envelope into another shard's channel.  If the
+		 * channel is full, keep taking our own inbound events while
+		 * we wait, so two shards sending to each other can't
+		 * deadlock.  Give up if the runtime stops, as the other
+		 * shard may never empty the channel.
+		 */
+		void post(Channel* c, const Envelope<E>& env) {
+			while (! c->push(env)) {
+				if (_runtime->stopped())
+					return;
+				if (! receive())
+					std::this_thread::yield();
+			}
+			_outbox[_runtime->shardOf(env.key)] = c;
+		};
+
+		/**
+		 * Queue an event on one of our HSMs, creating it if needed.
+		 */
+		void deliver(unsigned long key, const E& e) {
+			typename Machines::iterator it = _machines.find(key);
+			if (it != _machines.end()) {
+				it->second->cthsmQueueEvent(e);
+				schedule(it->second);
+				return;
+			}
+			typename Building::iterator b = _building.find(key);
+			if (b != _building.end()) {
+				b->second.push_back(e);
+				return;
+			}
+			create(key, e);
+		};
+
+		/**
+		 * Forget the HSM with key now, so later events make a new
+		 * one, and destroy it at the end of the pass.
+		 */
+		void retire(unsigned long key) {
+			typename Machines::iterator it = _machines.find(key);
+			if (it == _machines.end())
+				return;
+			_retired.push_back(it->second);
+			_machines.erase(it);
+		};
+
+		C* find(unsigned long key) {
+			typename Machines::iterator it = _machines.find(key);
+			return it == _machines.end() ? 0 : it->second;
+		};
+
+		/**
+		 * Run passes until stop(), then destroy our HSMs.
+		 */
+		virtual void run() {
+			while (! _stop.load(std::memory_order_relaxed)) {
+				unsigned n = receive();
+				runReady();
+				reap();
+				for (unsigned i = 0; i < _outbox.size(); i++) {
+					if (_outbox[i]) {
+						_outbox[i]->flush();
+						_outbox[i] = 0;
+					}
+				}
+				if (! n && ! ready())
+					std::this_thread::yield();
+			}
+			reap();
+			typename Machines::iterator it;
+			for (it = _machines.begin(); it != _machines.end();
+			     it++) {
+				unschedule(it->second);
+				destroy(it->second);
+			}
+			_machines.clear();
+		};
+
+		virtual void stop() {
+			_stop.store(true, std::memory_order_relaxed);
+		};
+
+		/**
+		 * Called by SpscChannel::pop().
+		 */
+		void operator()(const Envelope<E>& env) {
+			deliver(env.key, env.event);
+		};
+
+	private:
+		typedef std::unordered_map<unsigned long, C*> Machines;
+		typedef std::unordered_map<unsigned long, std::vector<E> >
+			Building;
+
+		/**
+		 * Make the HSM for key, and queue e on it.  The HSM's
+		 * constructor and initial entry actions may send to its own
+		 * key, so events for the key are held in _building until the
+		 * HSM exists, and then queued after e.
+		 */
+		void create(unsigned long key, const E& e) {
+			_building[key].push_back(e);
+			void* mem = _arena.allocate(sizeof(C));
+			C* m = _runtime->_factory(mem, key);
+			_machines[key] = m;
+			typename Building::iterator b = _building.find(key);
+			for (unsigned i = 0; i < b->second.size(); i++)
+				m->cthsmQueueEvent(b->second[i]);
+			_building.erase(b);
+			schedule(m);
+		};
+
+		/**
+		 * Take what is waiting in every inbound channel, and queue
+		 * it on our HSMs.
+		 *
+		 * \return the number of events taken.
+		 */
+		unsigned receive() {
+			unsigned n = 0;
+			for (unsigned i = 0; i < _inbox.size(); i++) {
+				if (_inbox[i])
+					n += _inbox[i]->pop(*this, BATCH);
+			}
+			return n;
+		};
+
+		/** Destroy the HSMs retired during this pass. */
+		void reap() {
+			for (unsigned i = 0; i < _retired.size(); i++) {
+				unschedule(_retired[i]);
+				destroy(_retired[i]);
+			}
+			_retired.clear();
+		};
+
+		void destroy(C* m) {
+			m->~C();
+			_arena.release(m, sizeof(C));
+		};
+
+		ShardedRuntime* _runtime;
+		unsigned _index;
+		ShardArena _arena;
+		Machines _machines;
+		/** Events for the HSMs being made by create(), by key. */
+		Building _building;
+		std::vector<C*> _retired;
+		/** Inbound channels, indexed by the sending shard. */
+		std::vector<Channel*> _inbox;
+		/**
+		 * Outbound channels pushed to in this pass, indexed by the
+		 * receiving shard, to be flushed at the end of the pass.
+		 */
+		std::vector<Channel*> _outbox;
+		std::atomic<bool> _stop;
+	};
+
+	void threadMain(Shard* s) {
+		_current = s;
+		if (_pin)
+			pinSelf(s->index());
+		s->open(_shards.size());
+		_started.fetch_add(1, std::memory_order_acq_rel);
+		// Wait until every shard has its channels before sending
+		// anything to them.
+		while (_started.load(std::memory_order_acquire) <
+		       _shards.size())
+			std::this_thread::yield();
+		s->run();
+		_current = 0;
+	};
+
+	void pinSelf(unsigned index) {
+		int cpu;
+		if (_cpus.size()) {
+			cpu = _cpus[index % _cpus.size()];
+		} else {
+			unsigned ncpus = std::thread::hardware_concurrency();
+			if (! ncpus)
+				return;
+			cpu = index % ncpus;
+		}
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	};
+
+	Factory _factory;
+	bool _pin;
+	std::vector<int> _cpus;
+	std::vector<Shard*> _shards;
+	std::vector<std::thread> _threads;
+	/** The number of shards that have opened their channels. */
+	std::atomic<unsigned> _started;
+	/** Set by stop(), after which send() drops events. */
+	std::atomic<bool> _stopped;
+
+	/** The shard that the calling thread runs, if any. */
+	static thread_local Shard* _current;
+};
+
+
+template<typename C, typename E, unsigned N, unsigned BATCH>
+thread_local typename ShardedRuntime<C,E,N,BATCH>::Shard*
+ShardedRuntime<C,E,N,BATCH>::_current = 0;
+
+
+} // namespace CTHSM
+#endif /* __cthsm_shard_hh__*/
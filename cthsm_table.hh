@@ -0,0 +1,873 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef __cthsm_table_hh__
+#define __cthsm_table_hh__
+
+/*
+ * Table driven HSMs.
+ *
+ * A CTHsm's hierarchy is compiled in, as member functions.  A TableHsm gets
+ * its hierarchy, and what each state does with each event, from a
+ * StateTable, which can be loaded from a file at run time.  The code that
+ * runs is in actions: C++ functions registered in a TableActions, and
+ * named in the table by number.
+ *
+ * The table is resolved in advance.  For every state and event, the table
+ * says which state (the state itself, or a parent) handles the event, and
+ * for every transition the table has the list of states to exit and the
+ * list of states to enter.  So handling an event is a few array lookups,
+ * with no walking up the hierarchy.
+ *
+ * TableHsm does what CTHsm does, in the same order: the handling state's
+ * action, then exit actions from the current state up, the transition
+ * action, and entry actions down to the destination.  Self transitions
+ * exit and re-enter the state, without the transition action, and the
+ * common parent of the source and destination is neither exited nor
+ * entered.  Events posted by actions are handled before the next sent
+ * event.
+ *
+ * The file format is:
+ *
+ * - a TableHeader;
+ * - a TableState for each state;
+ * - a TableReaction for each state and event, by state then event;
+ * - a TablePath for each distinct transition path;
+ * - the state numbers that the paths refer to, as uint32_t.
+ *
+ * Every field is a uint32_t in the byte order of the machine that wrote
+ * the file, so the file can be used where it is mapped, without decoding.
+ * Files are written by TableBuilder.
+ */
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace CTHSM {
+
+
+/** No state, action or path. */
+const uint32_t TABLE_NONE = 0xffffffff;
+
+struct TableHeader {
+	/** "CTHT" */
+	char magic[4];
+	/** TABLE_BYTE_ORDER, as written by the machine that made the file. */
+	uint32_t byteOrder;
+	uint32_t version;
+	/** The size of the whole file. */
+	uint32_t size;
+	/** FNV-1a hash of everything after the header. */
+	uint32_t checksum;
+	uint32_t nstates;
+	uint32_t nevents;
+	/** Action numbers go from 0 to nactions-1. */
+	uint32_t nactions;
+	uint32_t npaths;
+	uint32_t nitems;
+	uint32_t initial;
+};
+
+const uint32_t TABLE_BYTE_ORDER = 0x01020304;
+const uint32_t TABLE_VERSION = 1;
+
+/**
+ * One state.  State 0 is the top state, and every other state's parent has
+ * a lower number than the state.
+ */
+struct TableState {
+	/** TABLE_NONE for the top state. */
+	uint32_t parent;
+	uint32_t entry;
+	uint32_t exit;
+};
+
+/**
+ * What happens to one event in one state.
+ */
+struct TableReaction {
+	/**
+	 * The state that handles the event: this state or one of its
+	 * parents.  TABLE_NONE if none of them does, and the event is
+	 * ignored.
+	 */
+	uint32_t handler;
+	/** Called when the event is handled. */
+	uint32_t action;
+	/** The destination, or TABLE_NONE if there is no transition. */
+	uint32_t target;
+	/** The transition action. */
+	uint32_t tact;
+	/** The transition's path. */
+	uint32_t path;
+};
+
+/**
+ * The states to exit, then the states to enter, in order.  These are
+ * nexits + nentries items starting at first.
+ */
+struct TablePath {
+	uint32_t first;
+	uint32_t nexits;
+	uint32_t nentries;
+};
+
+
+/**
+ * 32 bit FNV-1a.
+ */
+inline uint32_t tableChecksum(const unsigned char* p, size_t n)
+{
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < n; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+/**
+ * A checked, read-only state table, either mapped from a file or in
+ * memory that belongs to someone else.
+ */
+class StateTable {
+public:
+	StateTable() : _data(0), _size(0), _mapped(false) { };
+
+	~StateTable() {
+		unload();
+	};
+
+	/** A mapped table can only be unmapped once, so it can't be copied. */
+	StateTable(const StateTable&) = delete;
+	StateTable& operator=(const StateTable&) = delete;
+
+	/**
+	 * Map a table file and check it.
+	 *
+	 * \return 0 if the table is good, or a description of the problem.
+	 */
+	const char* load(const char* filename) {
+		unload();
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return "cannot open table file";
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+			close(fd);
+			return "cannot read table file";
+		}
+		void* p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+			return "cannot map table file";
+		_data = static_cast<const unsigned char*>(p);
+		_size = st.st_size;
+		_mapped = true;
+		const char* error = check();
+		if (error)
+			unload();
+		return error;
+	};
+
+	/**
+	 * Use a table in memory, and check it.  The memory must stay valid,
+	 * and be aligned for uint32_t, while the table is in use.
+	 *
+	 * \return 0 if the table is good, or a description of the problem.
+	 */
+	const char* attach(const void* data, size_t size) {
+		unload();
+		_data = static_cast<const unsigned char*>(data);
+		_size = size;
+		const char* error = check();
+		if (error)
+			unload();
+		return error;
+	};
+
+	bool loaded() const {
+		return _data != 0;
+	};
+
+	uint32_t nstates() const {
+		return header()->nstates;
+	};
+
+	uint32_t nevents() const {
+		return header()->nevents;
+	};
+
+	uint32_t nactions() const {
+		return header()->nactions;
+	};
+
+	uint32_t initial() const {
+		return header()->initial;
+	};
+
+	const TableState& state(uint32_t s) const {
+		return states()[s];
+	};
+
+	const TableReaction& reaction(uint32_t s, uint32_t e) const {
+		return reactions()[s * header()->nevents + e];
+	};
+
+	const TablePath& path(uint32_t p) const {
+		return paths()[p];
+	};
+
+	const uint32_t* items() const {
+		return reinterpret_cast<const uint32_t*>(paths()
+							 + header()->npaths);
+	};
+
+private:
+	const TableHeader* header() const {
+		return reinterpret_cast<const TableHeader*>(_data);
+	};
+
+	const TableState* states() const {
+		return reinterpret_cast<const TableState*>(_data
+							   + sizeof(TableHeader));
+	};
+
+	const TableReaction* reactions() const {
+		return reinterpret_cast<const TableReaction*>(
+			states() + header()->nstates);
+	};
+
+	const TablePath* paths() const {
+		return reinterpret_cast<const TablePath*>(
+			reactions() + header()->nstates * header()->nevents);
+	};
+
+	void unload() {
+		if (_mapped)
+			munmap(const_cast<unsigned char*>(_data), _size);
+		_data = 0;
+		_size = 0;
+		_mapped = false;
+	};
+
+	/**
+	 * Check everything that TableHsm relies on, so that it never needs
+	 * to check an index.  This is one pass over the table.
+	 */
+	const char* check() const {
+		if (reinterpret_cast<uintptr_t>(_data) % sizeof(uint32_t))
+			return "table is not aligned";
+		if (_size < sizeof(TableHeader))
+			return "table is too short";
+		const TableHeader* h = header();
+		if (memcmp(h->magic, "CTHT", 4))
+			return "not a table file";
+		if (h->byteOrder != TABLE_BYTE_ORDER)
+			return "table has the wrong byte order";
+		if (h->version != TABLE_VERSION)
+			return "table has the wrong version";
+		if (h->size != _size)
+			return "table has the wrong size";
+
+		// Work the size out in 64 bits, so that huge counts can't
+		// wrap around.
+		uint64_t size = sizeof(TableHeader)
+			+ uint64_t(h->nstates) * sizeof(TableState)
+			+ uint64_t(h->nstates) * h->nevents
+			  * sizeof(TableReaction)
+			+ uint64_t(h->npaths) * sizeof(TablePath)
+			+ uint64_t(h->nitems) * sizeof(uint32_t);
+		if (size != _size)
+			return "table counts do not match its size";
+		if (tableChecksum(_data + sizeof(TableHeader),
+				  _size - sizeof(TableHeader)) != h->checksum)
+			return "table checksum is wrong";
+
+		if (! h->nstates)
+			return "table has no states";
+		if (h->initial >= h->nstates)
+			return "table has a bad initial state";
+		for (uint32_t s = 0; s < h->nstates; s++) {
+			const TableState& st = state(s);
+			if (s == 0 && st.parent != TABLE_NONE)
+				return "table state 0 is not the top state";
+			if (s != 0 && st.parent >= s)
+				return "table state has a bad parent";
+			if (! action(st.entry) || ! action(st.exit))
+				return "table state has a bad action";
+		}
+		uint32_t n = h->nstates * h->nevents;
+		for (uint32_t i = 0; i < n; i++) {
+			const TableReaction& r = reactions()[i];
+			if (r.handler == TABLE_NONE)
+				continue;
+			if (r.handler >= h->nstates)
+				return "table reaction has a bad handler";
+			if (! action(r.action) || ! action(r.tact))
+				return "table reaction has a bad action";
+			if (r.target == TABLE_NONE)
+				continue;
+			if (r.target >= h->nstates || r.path >= h->npaths)
+				return "table reaction has a bad transition";
+		}
+		for (uint32_t p = 0; p < h->npaths; p++) {
+			const TablePath& tp = path(p);
+			if (uint64_t(tp.first) + tp.nexits + tp.nentries
+			    > h->nitems)
+				return "table path is out of range";
+		}
+		for (uint32_t i = 0; i < h->nitems; i++) {
+			if (items()[i] >= h->nstates)
+				return "table path has a bad state";
+		}
+		return 0;
+	};
+
+	bool action(uint32_t a) const {
+		return a == TABLE_NONE || a < header()->nactions;
+	};
+
+	const unsigned char* _data;
+	size_t _size;
+	bool _mapped;
+};
+
+
+class TableHsm;
+
+/**
+ * The actions that table numbers refer to.
+ */
+class TableActions {
+public:
+	/**
+	 * An action.  hsm.actionState() and hsm.event() say what it is
+	 * being called for.
+	 *
+	 * \arg id the action's number, so that one function can serve for
+	 * several numbers.
+	 */
+	typedef void (*Action)(TableHsm& hsm, uint32_t id);
+
+	TableActions() : _actions() { };
+
+	void bind(uint32_t id, Action action) {
+		if (id >= _actions.size())
+			_actions.resize(id + 1, 0);
+		_actions[id] = action;
+	};
+
+	/**
+	 * \return 0 if every action number in the table has an action, or
+	 * a description of the problem.
+	 */
+	const char* check(const StateTable& table) const {
+		if (table.nactions() > _actions.size())
+			return "table uses an action that is not bound";
+		for (uint32_t i = 0; i < table.nactions(); i++) {
+			if (! _actions[i])
+				return "table uses an action that is not bound";
+		}
+		return 0;
+	};
+
+	Action operator[](uint32_t id) const {
+		return _actions[id];
+	};
+
+private:
+	std::vector<Action> _actions;
+};
+
+
+/**
+ * An HSM run from a StateTable.
+ *
+ * Events are numbers from 0 to the table's nevents-1.  Like CTHsm,
+ * sendEvent() handles events to completion, and events sent by actions
+ * are queued until the current event is done.
+ *
+ * Any number of TableHsms can share one StateTable and one TableActions.
+ * Each has a user pointer for its own data.
+ */
+class TableHsm {
+public:
+	/**
+	 * table must be loaded.  If it is not, that is reported on std::cerr
+	 * and the program is aborted.
+	 */
+	TableHsm(const StateTable& table, const TableActions& actions,
+		 void* user = 0)
+		: _table(table), _actions(actions), _user(user),
+		  _state(initialState(table)), _actionState(TABLE_NONE),
+		  _event(TABLE_NONE), _events(), _internal(),
+		  _event_lock(false), _started(false)
+	{ };
+
+	/**
+	 * Exits back to the top state, like CTHsm.
+	 */
+	virtual ~TableHsm() {
+		if (! _started)
+			return;
+		_event_lock = true;
+		_event = TABLE_NONE;
+		for (uint32_t s = _state; s != TABLE_NONE;
+		     s = _table.state(s).parent)
+			call(_table.state(s).exit, s);
+	};
+
+	/**
+	 * Enter the initial state, from the top state down.  The actions are
+	 * checked first, and if any are missing, the problem is reported on
+	 * std::cerr and the program is aborted, as CTHsm::cthsmStart() does
+	 * for a broken hierarchy.
+	 */
+	void start() {
+		assert( _table.loaded() );
+		const char* error = _actions.check(_table);
+		if (error) {
+			std::cerr << "TableHsm: " << error << "\n";
+			std::abort();
+		}
+		_started = true;
+		_event_lock = true;
+		std::vector<uint32_t> chain;
+		for (uint32_t s = _state; s != TABLE_NONE;
+		     s = _table.state(s).parent)
+			chain.push_back(s);
+		for (unsigned i = chain.size(); i--; )
+			call(_table.state(chain[i]).entry, chain[i]);
+		sendInternalEvents();
+		_event_lock = false;
+		sendEvents();
+	};
+
+	/**
+	 * Send an event.  An event that is not in the table is reported on
+	 * std::cerr and dropped.
+	 *
+	 * \return true if there are still events waiting, which is only the
+	 * case when this is called from an action.
+	 */
+	bool sendEvent(uint32_t event) {
+		assert( _started );
+		if (! knownEvent(event))
+			return _event_lock;
+		_events.push_back(event);
+		if (_event_lock)
+			return true;
+		sendEvents();
+		return false;
+	};
+
+	/**
+	 * Post an internal event.  Only call this from an action.  Like
+	 * CTHsm::cth_post(), these are handled as soon as the current event
+	 * is done.  An event that is not in the table is reported on
+	 * std::cerr and dropped.
+	 */
+	void post(uint32_t event) {
+		assert( _event_lock );
+		if (! knownEvent(event))
+			return;
+		_internal.push_back(event);
+	};
+
+	uint32_t state() const {
+		return _state;
+	};
+
+	/**
+	 * \return true if s is the current state or one of its parents.
+	 */
+	bool inState(uint32_t s) const {
+		for (uint32_t t = _state; t != TABLE_NONE;
+		     t = _table.state(t).parent) {
+			if (t == s)
+				return true;
+		}
+		return false;
+	};
+
+	/**
+	 * In an action, the state it belongs to: the state being entered or
+	 * exited, or the state handling the event.
+	 */
+	uint32_t actionState() const {
+		return _actionState;
+	};
+
+	/**
+	 * In an action, the event being handled, or TABLE_NONE during the
+	 * initial and final transitions.
+	 */
+	uint32_t event() const {
+		return _event;
+	};
+
+	void* user() const {
+		return _user;
+	};
+
+private:
+	static uint32_t initialState(const StateTable& table) {
+		if (! table.loaded()) {
+			std::cerr << "TableHsm: the state table is not loaded\n";
+			std::abort();
+		}
+		return table.initial();
+	};
+
+	bool knownEvent(uint32_t event) const {
+		if (event < _table.nevents())
+			return true;
+		std::cerr << "TableHsm: event " << event << " is not in the "
+			  << "table, which has " << _table.nevents()
+			  << " events\n";
+		return false;
+	};
+
+	void call(uint32_t action, uint32_t state) {
+		if (action == TABLE_NONE)
+			return;
+		_actionState = state;
+		_actions[action](*this, action);
+	};
+
+	void sendEvents() {
+		while (_events.size()) {
+			uint32_t e = _events.front();
+			_events.pop_front();
+			_event_lock = true;
+			dispatch(e);
+			sendInternalEvents();
+			_event_lock = false;
+		}
+	};
+
+	void sendInternalEvents() {
+		while (_internal.size()) {
+			uint32_t e = _internal.front();
+			_internal.pop_front();
+			dispatch(e);
+		}
+	};
+
+	void dispatch(uint32_t e) {
+		const TableReaction& r = _table.reaction(_state, e);
+		if (r.handler == TABLE_NONE)
+			return;
+		_event = e;
+		call(r.action, r.handler);
+		if (r.target == TABLE_NONE)
+			return;
+
+		const TablePath& p = _table.path(r.path);
+		const uint32_t* s = _table.items() + p.first;
+		for (uint32_t i = 0; i < p.nexits; i++, s++)
+			call(_table.state(*s).exit, *s);
+		call(r.tact, r.handler);
+		for (uint32_t i = 0; i < p.nentries; i++, s++)
+			call(_table.state(*s).entry, *s);
+		_state = r.target;
+	};
+
+	const StateTable& _table;
+	const TableActions& _actions;
+	void* _user;
+	uint32_t _state;
+	uint32_t _actionState;
+	uint32_t _event;
+	std::deque<uint32_t> _events;
+	std::deque<uint32_t> _internal;
+	bool _event_lock;
+	bool _started;
+};
+
+
+/**
+ * Makes state tables.
+ *
+ * Add the top state first, then the other states, each after its parent.
+ * Then say what each state does with each event it handles; events a
+ * state doesn't handle go to its parent.  build() resolves the handler of
+ * every event in every state, and the path of every transition, and
+ * returns the table.
+ */
+class TableBuilder {
+public:
+	TableBuilder(uint32_t nevents)
+		: _nevents(nevents), _initial(TABLE_NONE), _states(),
+		  _reactions(), _nactions(0)
+	{ };
+
+	/**
+	 * Add a state.
+	 *
+	 * \arg parent the parent state, or TABLE_NONE for the top state.
+	 * \arg entry, exit the entry and exit actions, or TABLE_NONE.
+	 * \return the state's number.
+	 */
+	uint32_t state(uint32_t parent, uint32_t entry = TABLE_NONE,
+		       uint32_t exit = TABLE_NONE) {
+		uint32_t s = _states.size();
+		assert( s == 0 ? parent == TABLE_NONE : parent < s );
+		TableState st;
+		st.parent = parent;
+		st.entry = entry;
+		st.exit = exit;
+		_states.push_back(st);
+		Reaction none;
+		_reactions.resize(_reactions.size() + _nevents, none);
+		useAction(entry);
+		useAction(exit);
+		return s;
+	};
+
+	/**
+	 * state handles event without a transition, calling action.
+	 */
+	void handle(uint32_t state, uint32_t event,
+		    uint32_t action = TABLE_NONE) {
+		Reaction& r = reaction(state, event);
+		r.handled = true;
+		r.action = action;
+		useAction(action);
+	};
+
+	/**
+	 * state handles event by calling action, then transitioning to
+	 * target, with the transition action tact.  As in CTHsm, tact is not
+	 * called when target is state, or when either of them is the top
+	 * state, and build() leaves it out of the table.
+	 */
+	void transition(uint32_t state, uint32_t event, uint32_t target,
+			uint32_t tact = TABLE_NONE,
+			uint32_t action = TABLE_NONE) {
+		assert( target < _states.size() );
+		handle(state, event, action);
+		Reaction& r = reaction(state, event);
+		r.target = target;
+		r.tact = tact;
+		useAction(tact);
+	};
+
+	void initial(uint32_t state) {
+		assert( state < _states.size() );
+		_initial = state;
+	};
+
+	/**
+	 * \return the table, ready for StateTable::attach() or to be written
+	 * to a file.
+	 */
+	std::string build() const {
+		assert( _states.size() && _initial != TABLE_NONE );
+		uint32_t nstates = _states.size();
+
+		std::vector<TableReaction> reactions(nstates * _nevents);
+		std::vector<TablePath> paths;
+		std::vector<uint32_t> items;
+		// Paths by (src,dst), so each one is only stored once.
+		std::vector<uint32_t> pathIndex(nstates * nstates,
+						TABLE_NONE);
+
+		for (uint32_t s = 0; s < nstates; s++) {
+			for (uint32_t e = 0; e < _nevents; e++) {
+				TableReaction& r = reactions[s * _nevents + e];
+				r.handler = TABLE_NONE;
+				r.action = TABLE_NONE;
+				r.target = TABLE_NONE;
+				r.tact = TABLE_NONE;
+				r.path = TABLE_NONE;
+				uint32_t h = s;
+				while (h != TABLE_NONE
+				       && ! _reactions[h * _nevents + e].handled)
+					h = _states[h].parent;
+				if (h == TABLE_NONE)
+					continue;
+				const Reaction& from =
+					_reactions[h * _nevents + e];
+				r.handler = h;
+				r.action = from.action;
+				if (from.target == TABLE_NONE)
+					continue;
+				r.target = from.target;
+				uint32_t& p = pathIndex[s * nstates + r.target];
+				if (p == TABLE_NONE) {
+					p = paths.size();
+					paths.push_back(makePath(s, r.target,
+								 items));
+				}
+				r.path = p;
+				// CTHsm does not call the transition action
+				// for self transitions, or for transitions to
+				// or from the top state.
+				if (s != r.target && s != 0 && r.target != 0)
+					r.tact = from.tact;
+			}
+		}
+
+		TableHeader h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, "CTHT", 4);
+		h.byteOrder = TABLE_BYTE_ORDER;
+		h.version = TABLE_VERSION;
+		h.nstates = nstates;
+		h.nevents = _nevents;
+		h.nactions = _nactions;
+		h.npaths = paths.size();
+		h.nitems = items.size();
+		h.initial = _initial;
+
+		std::string body;
+		append(body, &_states[0], nstates * sizeof(TableState));
+		if (reactions.size())
+			append(body, &reactions[0],
+			       reactions.size() * sizeof(TableReaction));
+		if (paths.size())
+			append(body, &paths[0],
+			       paths.size() * sizeof(TablePath));
+		if (items.size())
+			append(body, &items[0],
+			       items.size() * sizeof(uint32_t));
+		h.size = sizeof(h) + body.size();
+		h.checksum = tableChecksum(
+			reinterpret_cast<const unsigned char*>(body.data()),
+			body.size());
+
+		std::string table;
+		append(table, &h, sizeof(h));
+		return table + body;
+	};
+
+	/**
+	 * Write the table to a file.
+	 *
+	 * \return 0, or a description of the problem.
+	 */
+	const char* write(const char* filename) const {
+		std::string table = build();
+		int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			return "cannot create table file";
+		ssize_t n = ::write(fd, table.data(), table.size());
+		if (close(fd) < 0 || n != ssize_t(table.size()))
+			return "cannot write table file";
+		return 0;
+	};
+
+private:
+	struct Reaction {
+		Reaction() : handled(false), action(TABLE_NONE),
+			     target(TABLE_NONE), tact(TABLE_NONE) { };
+		bool handled;
+		uint32_t action;
+		uint32_t target;
+		uint32_t tact;
+	};
+
+	Reaction& reaction(uint32_t state, uint32_t event) {
+		assert( state < _states.size() && event < _nevents );
+		return _reactions[state * _nevents + event];
+	};
+
+	void useAction(uint32_t action) {
+		if (action != TABLE_NONE && action >= _nactions)
+			_nactions = action + 1;
+	};
+
+	static void append(std::string& s, const void* p, size_t n) {
+		s.append(static_cast<const char*>(p), n);
+	};
+
+	uint32_t depth(uint32_t s) const {
+		uint32_t d = 0;
+		while (_states[s].parent != TABLE_NONE) {
+			s = _states[s].parent;
+			d++;
+		}
+		return d;
+	};
+
+	/**
+	 * Work out the path of a transition the way CTHsm::transition()
+	 * does, and add its states to items.
+	 */
+	TablePath makePath(uint32_t src, uint32_t dst,
+			   std::vector<uint32_t>& items) const {
+		std::vector<uint32_t> exits;
+		std::vector<uint32_t> entries;
+		if (src == dst) {
+			exits.push_back(src);
+			entries.push_back(dst);
+		} else if (src == 0) {
+			// From the top state: enter everything from the top
+			// down, including the top state.
+			for (uint32_t s = dst; s != TABLE_NONE;
+			     s = _states[s].parent)
+				entries.push_back(s);
+		} else if (dst == 0) {
+			// To the top state: exit everything, including the
+			// top state, and enter nothing.
+			for (uint32_t s = src; s != TABLE_NONE;
+			     s = _states[s].parent)
+				exits.push_back(s);
+		} else {
+			uint32_t a = src;
+			uint32_t b = dst;
+			uint32_t da = depth(a);
+			uint32_t db = depth(b);
+			for (; da > db; da--) {
+				exits.push_back(a);
+				a = _states[a].parent;
+			}
+			for (; db > da; db--) {
+				entries.push_back(b);
+				b = _states[b].parent;
+			}
+			while (a != b) {
+				exits.push_back(a);
+				a = _states[a].parent;
+				entries.push_back(b);
+				b = _states[b].parent;
+			}
+		}
+		TablePath p;
+		p.first = items.size();
+		p.nexits = exits.size();
+		p.nentries = entries.size();
+		items.insert(items.end(), exits.begin(), exits.end());
+		items.insert(items.end(), entries.rbegin(), entries.rend());
+		return p;
+	};
+
+	uint32_t _nevents;
+	uint32_t _initial;
+	std::vector<TableState> _states;
+	std::vector<Reaction> _reactions;
+	uint32_t _nactions;
+};
+
+
+} // namespace CTHSM
+#endif /* __cthsm_table_hh__*/
@@ -0,0 +1,39 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef __check_hh__
+#define __check_hh__
+
+/*
+ * Checks for the test programs.  A failed CHECK() is reported on std::cerr
+ * and counted, and the test carries on, so one run shows every failure.
+ * main() ends with "return checkStatus();".
+ */
+
+#include <iostream>
+
+static int errors = 0;
+
+#define CHECK(x) do {							\
+		if (!(x)) {						\
+			std::cerr << __FILE__ << ":" << __LINE__	\
+				  << ": failed: " #x "\n";		\
+			errors++;					\
+		}							\
+	} while (0)
+
+/**
+ * \return the test's exit status: 0, or 99 if any CHECK() failed.
+ */
+static inline int checkStatus()
+{
+	return errors ? 99 : 0;
+}
+
+#endif /* __check_hh__ */
@@ -0,0 +1,14 @@
+#!/bin/sh
+
+. ./testlibrary.sh
+
+test_header "Event bus"
+
+do_this_test && {
+	(
+	cd t02 &&
+	run_test "publish and subscribe" ./test1.sh 0 :
+	)
+}
+
+test_trailer
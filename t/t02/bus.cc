@@ -0,0 +1,266 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "cthsm_bus.hh"
+#include "../check.hh"
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace CTHSM;
+
+struct Payload {
+	std::string text;
+};
+
+enum {
+	EV_DATA = Event::CTHE_USER,
+	EV_STOP,
+	EV_NOBODY,
+};
+
+typedef SharedEvent<Payload> BusEvent;
+
+
+/**
+ * Counts the EV_DATA events it gets, and remembers the last payload.
+ */
+class Listener : public CTHsm<Listener, BusEvent> {
+public:
+	Listener() : CTHsm<Listener,BusEvent>(&Listener::listening),
+		     count(0), last(0)
+	{
+		cthsmStart();
+	};
+
+	CTHsmState listening(BusEvent e) {
+		switch (e.event()) {
+		case EV_DATA:
+			count++;
+			last = e.payload();
+			return cth_handled();
+		default:
+			return cth_parent(&Listener::topState);
+		}
+	};
+
+	int count;
+	const Payload* last;
+};
+
+
+/**
+ * Only wants EV_DATA while waiting.  EV_STOP moves it to stopped.
+ */
+class Picky : public CTHsm<Picky, BusEvent> {
+public:
+	Picky() : CTHsm<Picky,BusEvent>(&Picky::waiting), count(0)
+	{
+		cthsmStart();
+	};
+
+	CTHsmState running(BusEvent e) {
+		switch (e.event()) {
+		default:
+			return cth_parent(&Picky::topState);
+		}
+	};
+
+	CTHsmState waiting(BusEvent e) {
+		switch (e.event()) {
+		case EV_DATA:
+			count++;
+			return cth_handled();
+		case EV_STOP:
+			return cth_transition(&Picky::stopped);
+		default:
+			return cth_parent(&Picky::running);
+		}
+	};
+
+	CTHsmState stopped(BusEvent e) {
+		switch (e.event()) {
+		case EV_DATA:
+			// Should never get here, since we only subscribed
+			// while waiting.
+			count += 1000;
+			return cth_handled();
+		default:
+			return cth_parent(&Picky::running);
+		}
+	};
+
+	int count;
+};
+
+
+/**
+ * Stands in for a worker thread.  Records the size of each batch, then
+ * delivers the batch straight away.
+ */
+class TestDispatcher : public BusDispatcher<BusEvent> {
+public:
+	TestDispatcher() : calls(0), offered(0) { };
+
+	virtual void dispatch(BusEvent e, const Batch& batch) {
+		calls++;
+		for (unsigned i = 0; i < batch.size(); i++) {
+			batch[i]->offer(e);
+			offered++;
+		}
+	};
+
+	int calls;
+	int offered;
+};
+
+
+/**
+ * Stands in for a worker thread that gets round to its batches later.
+ */
+class DeferredDispatcher : public BusDispatcher<BusEvent> {
+public:
+	virtual void dispatch(BusEvent e, const Batch& batch) {
+		for (unsigned i = 0; i < batch.size(); i++)
+			_later.push_back(std::make_pair(e, batch[i]));
+	};
+
+	/**
+	 * \return the number of events the subscribers took.
+	 */
+	int run() {
+		int n = 0;
+		for (unsigned i = 0; i < _later.size(); i++) {
+			if (_later[i].second->offer(_later[i].first))
+				n++;
+		}
+		_later.clear();
+		return n;
+	};
+
+private:
+	std::vector<std::pair<BusEvent,
+			      std::shared_ptr<BusSubscriber<BusEvent> > > >
+		_later;
+};
+
+
+/**
+ * Unsubscribes itself when it gets EV_DATA.
+ */
+class Quitter : public CTHsm<Quitter, BusEvent> {
+public:
+	Quitter(EventBus<BusEvent>& bus)
+		: CTHsm<Quitter,BusEvent>(&Quitter::listening), count(0),
+		  _bus(bus)
+	{
+		cthsmStart();
+	};
+
+	CTHsmState listening(BusEvent e) {
+		switch (e.event()) {
+		case EV_DATA:
+			count++;
+			_bus.unsubscribe(this);
+			return cth_handled();
+		default:
+			return cth_parent(&Quitter::topState);
+		}
+	};
+
+	int count;
+
+private:
+	EventBus<BusEvent>& _bus;
+};
+
+
+int main(int argc, char **argv)
+{
+	EventBus<BusEvent> bus;
+	Listener l1, l2;
+	Picky p;
+
+	bus.subscribe(&l1, EV_DATA);
+	bus.subscribe(&l2, EV_DATA);
+	bus.subscribeInState(&p, EV_DATA, &Picky::waiting);
+	bus.subscribe(&p, EV_STOP);
+	CHECK( bus.subscribers(EV_DATA) == 3 );
+	CHECK( bus.subscribers(EV_NOBODY) == 0 );
+
+	// One payload, shared by every subscriber.
+	std::shared_ptr<const Payload> data(new Payload());
+	BusEvent e(EV_DATA, data);
+	CHECK( bus.publish(e) == 3 );
+	CHECK( l1.count == 1 );
+	CHECK( l2.count == 1 );
+	CHECK( p.count == 1 );
+	CHECK( l1.last == data.get() );
+	CHECK( l2.last == data.get() );
+
+	// Nobody listens to this one.
+	CHECK( bus.publish(BusEvent(EV_NOBODY)) == 0 );
+
+	// Once Picky has stopped, it does not get EV_DATA any more.
+	CHECK( bus.publish(BusEvent(EV_STOP)) == 1 );
+	CHECK( ! p.cthsmInState(&Picky::waiting) );
+	CHECK( p.cthsmInState(&Picky::running) );
+	CHECK( bus.publish(e) == 2 );
+	CHECK( p.count == 1 );
+
+	bus.unsubscribe(&l1);
+	CHECK( bus.subscribers(EV_DATA) == 2 );
+	CHECK( bus.publish(e) == 1 );
+	CHECK( l1.count == 2 );
+	CHECK( l2.count == 3 );
+
+	// Subscribers that share a dispatcher are delivered in one batch.
+	TestDispatcher d1, d2;
+	Listener l3, l4, l5;
+	bus.subscribe(&l3, EV_DATA, &d1);
+	bus.subscribe(&l4, EV_DATA, &d1);
+	bus.subscribe(&l5, EV_DATA, &d2);
+	CHECK( bus.publish(e) == 4 );
+	CHECK( d1.calls == 1 );
+	CHECK( d1.offered == 2 );
+	CHECK( d2.calls == 1 );
+	CHECK( d2.offered == 1 );
+	CHECK( l3.count == 1 && l4.count == 1 && l5.count == 1 );
+	CHECK( l2.count == 4 );
+
+	// The payload has one reference for data, one for e, and none left
+	// over in any of the HSMs' queues.
+	CHECK( data.use_count() == 2 );
+
+	// An HSM can unsubscribe while the bus is offering it an event.
+	Quitter q(bus);
+	bus.subscribe(&q, EV_DATA);
+	CHECK( bus.publish(e) == 5 );
+	CHECK( q.count == 1 );
+	CHECK( bus.subscribers(EV_DATA) == 5 );
+	CHECK( bus.publish(e) == 4 );
+	CHECK( q.count == 1 );
+
+	// An HSM unsubscribed, and destroyed, while a dispatcher still has
+	// an event for it is not sent that event.
+	DeferredDispatcher deferred;
+	Listener* gone = new Listener;
+	Listener kept;
+	bus.subscribe(gone, EV_DATA, &deferred);
+	bus.subscribe(&kept, EV_DATA, &deferred);
+	CHECK( bus.publish(e) == 6 );
+	bus.unsubscribe(gone);
+	delete gone;
+	CHECK( bus.subscribers(EV_DATA) == 6 );
+	CHECK( deferred.run() == 1 );
+	CHECK( kept.count == 1 );
+
+	return checkStatus();
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+
+. ./testlibrary.sh
+
+test_header "Event queue"
+
+do_this_test && {
+	(
+	cd t03 &&
+	run_test "run-to-completion budget" ./test1.sh 0 :
+	)
+}
+
+do_this_test && {
+	(
+	cd t03 &&
+	run_test "internal events" ./test2.sh 0 :
+	)
+}
+
+do_this_test && {
+	(
+	cd t03 &&
+	run_test "queue policies" ./test3.sh 0 :
+	)
+}
+
+test_trailer
@@ -0,0 +1,133 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "cthsm.hh"
+#include "../check.hh"
+#include <iostream>
+
+using namespace CTHSM;
+
+
+class E3 : public Event {
+public:
+	E3(int n) : Event(n) { };
+	enum {
+		EV_TICK = CTHE_USER,
+	};
+};
+
+
+/**
+ * Each EV_TICK sends another EV_TICK to ourselves until we have done
+ * enough, and flips between two states so that every event causes a
+ * transition.
+ */
+class Chatty : public CTHsm<Chatty, E3> {
+public:
+	Chatty(int n) : CTHsm<Chatty,E3>(&Chatty::ping),
+			remaining(n), ticks(0), entries(0)
+	{
+		cthsmStart();
+	};
+
+	CTHsmState ping(E3 e) {
+		switch (e.event()) {
+		case E3::CTHE_ENTRY:
+			entries++;
+			return cth_handled();
+		case E3::EV_TICK:
+			tick();
+			return cth_transition(&Chatty::pong);
+		default:
+			return cth_parent(&Chatty::topState);
+		}
+	};
+
+	CTHsmState pong(E3 e) {
+		switch (e.event()) {
+		case E3::CTHE_ENTRY:
+			entries++;
+			return cth_handled();
+		case E3::EV_TICK:
+			tick();
+			return cth_transition(&Chatty::ping);
+		default:
+			return cth_parent(&Chatty::topState);
+		}
+	};
+
+	void tick() {
+		ticks++;
+		if (remaining) {
+			remaining--;
+			// Queued, since we are inside a state function.
+			CHECK( sendEvent(E3(E3::EV_TICK)) );
+		}
+	};
+
+	int remaining;
+	int ticks;
+	int entries;
+};
+
+
+int main(int argc, char **argv)
+{
+	// No budget: everything is done in the first call.
+	{
+		Chatty c(9);
+		CHECK( ! c.sendEvent(E3(E3::EV_TICK)) );
+		CHECK( c.ticks == 10 );
+		CHECK( ! c.cthsmPending() );
+	}
+
+	// A budget of four events per call.
+	{
+		Chatty c(9);
+		c.cthsmSetBudget(4);
+		CHECK( c.entries == 1 );
+		CHECK( c.sendEvent(E3(E3::EV_TICK)) );
+		CHECK( c.ticks == 4 );
+		// Each event ran to completion, including its transition.
+		CHECK( c.entries == 5 );
+		CHECK( c.cthsmPending() );
+		CHECK( c.cthsmRun() );
+		CHECK( c.ticks == 8 );
+		CHECK( ! c.cthsmRun() );
+		CHECK( c.ticks == 10 );
+		CHECK( c.entries == 11 );
+		CHECK( ! c.cthsmPending() );
+		// Nothing to do.
+		CHECK( ! c.cthsmRun() );
+		CHECK( c.ticks == 10 );
+	}
+
+	// A time budget that is always used up by the first event.  At least
+	// one event is handled on each call.
+	{
+		Chatty c(2);
+		c.cthsmSetBudget(0, 1);
+		CHECK( c.sendEvent(E3(E3::EV_TICK)) );
+		CHECK( c.ticks == 1 );
+		CHECK( c.cthsmRun() );
+		CHECK( c.ticks == 2 );
+		CHECK( ! c.cthsmRun() );
+		CHECK( c.ticks == 3 );
+	}
+
+	// A generous time budget does not stop anything.
+	{
+		Chatty c(20);
+		c.cthsmSetBudget(0, 1000000000UL);
+		CHECK( ! c.sendEvent(E3(E3::EV_TICK)) );
+		CHECK( c.ticks == 21 );
+	}
+
+	return checkStatus();
+}
@@ -0,0 +1,191 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "cthsm.hh"
+#include "../check.hh"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace CTHSM;
+
+
+class E4 : public Event {
+public:
+	E4(int n) : Event(n) { };
+	enum {
+		EV_START = CTHE_USER,
+		EV_EXT,
+		EV_INT1,
+		EV_INT2,
+		EV_INT3,
+		EV_READY,
+	};
+};
+
+
+/**
+ * Records the order in which it handles events, as a string of letters.
+ */
+class Poster : public CTHsm<Poster, E4> {
+public:
+	Poster() : CTHsm<Poster,E4>(&Poster::idle)
+	{
+		cthsmStart();
+	};
+
+	CTHsmState idle(E4 e) {
+		switch (e.event()) {
+		case E4::CTHE_ENTRY:
+			// Handled after the initial transition is complete.
+			cth_post(E4(E4::EV_READY));
+			return cth_handled();
+		case E4::EV_READY:
+			trace += "R";
+			return cth_handled();
+		case E4::EV_START:
+			trace += "S";
+			sendEvent(E4(E4::EV_EXT));
+			cth_post(E4(E4::EV_INT1));
+			cth_post(E4(E4::EV_INT2));
+			return cth_transition(&Poster::busy);
+		default:
+			return cth_parent(&Poster::topState);
+		}
+	};
+
+	CTHsmState busy(E4 e) {
+		switch (e.event()) {
+		case E4::CTHE_ENTRY:
+			trace += "b";
+			return cth_handled();
+		case E4::EV_INT1:
+			trace += "1";
+			cth_post(E4(E4::EV_INT3));
+			return cth_handled();
+		case E4::EV_INT2:
+			trace += "2";
+			return cth_handled();
+		case E4::EV_INT3:
+			trace += "3";
+			return cth_handled();
+		case E4::EV_EXT:
+			trace += "X";
+			return cth_transition(&Poster::idle);
+		default:
+			return cth_parent(&Poster::topState);
+		}
+	};
+
+	std::string trace;
+};
+
+
+/**
+ * An event that counts how many copies of it are alive, so that we can
+ * see that every posted event is destroyed exactly once.
+ */
+class Counted : public Event {
+public:
+	Counted(int n, int seq = -1) : Event(n), seq(seq) {
+		live++;
+	};
+	Counted(const Counted& other) : Event(other), seq(other.seq) {
+		live++;
+	};
+	~Counted() {
+		live--;
+	};
+	enum {
+		EV_BURST = CTHE_USER,
+		EV_SEQ,
+	};
+
+	int seq;
+	static int live;
+};
+
+int Counted::live = 0;
+
+
+/** More than MAX_INTERNAL_EVENTS. */
+const int BURST = 20;
+
+
+/**
+ * Posts BURST events at once, and more from inside one of them, and
+ * BURST more from its exit action, which are never handled.
+ */
+class Burster : public CTHsm<Burster, Counted> {
+public:
+	Burster() : CTHsm<Burster,Counted>(&Burster::running)
+	{
+		cthsmStart();
+	};
+
+	CTHsmState running(Counted e) {
+		switch (e.event()) {
+		case Counted::CTHE_EXIT:
+			for (int i = 0; i < BURST; i++)
+				cth_post(Counted(Counted::EV_SEQ, 100 + i));
+			return cth_handled();
+		case Counted::EV_BURST:
+			for (int i = 0; i < BURST; i++)
+				cth_post(Counted(Counted::EV_SEQ, i));
+			return cth_handled();
+		case Counted::EV_SEQ:
+			seen.push_back(e.seq);
+			// Posted when some events are in the buffer and
+			// some have overflowed, so this must go after all of
+			// them.
+			if (e.seq == 2)
+				cth_post(Counted(Counted::EV_SEQ, BURST));
+			// Posted when only overflowed events are left.
+			if (e.seq == 12)
+				cth_post(Counted(Counted::EV_SEQ, BURST + 1));
+			return cth_handled();
+		default:
+			return cth_parent(&Burster::topState);
+		}
+	};
+
+	std::vector<int> seen;
+};
+
+
+int main(int argc, char **argv)
+{
+	Poster p;
+	CHECK( p.trace == "R" );
+
+	p.trace = "";
+	p.sendEvent(E4(E4::EV_START));
+	// The transition to busy completes first, then the internal events
+	// in order (with INT3 joining the back), then the queued external
+	// event, then the READY posted by idle's entry action.
+	CHECK( p.trace == "Sb123XR" );
+	if (p.trace != "Sb123XR")
+		std::cerr << "trace is " << p.trace << "\n";
+
+	// More internal events than fit in the buffer are all handled, once
+	// each, in the order they were posted.
+	Burster* b = new Burster;
+	b->sendEvent(Counted(Counted::EV_BURST));
+	CHECK( b->seen.size() == BURST + 2 );
+	for (unsigned i = 0; i < b->seen.size(); i++)
+		CHECK( b->seen[i] == int(i) );
+	CHECK( Counted::live == 0 );
+	b->seen.clear();
+	b->sendEvent(Counted(Counted::EV_BURST));
+	CHECK( b->seen.size() == BURST + 2 );
+	delete b;
+	CHECK( Counted::live == 0 );
+
+	return checkStatus();
+}
@@ -0,0 +1,123 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "cthsm.hh"
+#include "../check.hh"
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace CTHSM;
+
+
+class E6 : public Event {
+public:
+	E6(int n) : Event(n), value(0) { };
+	E6(int n, int value) : Event(n), value(value) { };
+	enum {
+		EV_PLAIN = CTHE_USER,
+		EV_LATEST,
+		EV_ONCE,
+		EV_COUNT,
+	};
+	int value;
+};
+
+
+/**
+ * Records each event it handles as "letter value/count".
+ */
+class Flooded : public CTHsm<Flooded, E6> {
+public:
+	Flooded() : CTHsm<Flooded,E6>(&Flooded::listening)
+	{
+		cthsmStart();
+		cthsmSetQueuePolicy(E6::EV_LATEST, CTHQ_COALESCE);
+		cthsmSetQueuePolicy(E6::EV_ONCE, CTHQ_DEDUP);
+		cthsmSetQueuePolicy(E6::EV_COUNT, CTHQ_COUNTED);
+	};
+
+	CTHsmState listening(E6 e) {
+		switch (e.event()) {
+		case E6::EV_PLAIN:
+			record("P", e);
+			return cth_handled();
+		case E6::EV_LATEST:
+			record("L", e);
+			return cth_handled();
+		case E6::EV_ONCE:
+			record("O", e);
+			return cth_handled();
+		case E6::EV_COUNT:
+			record("C", e);
+			return cth_handled();
+		default:
+			return cth_parent(&Flooded::topState);
+		}
+	};
+
+	void record(const char* name, E6 e) {
+		std::ostringstream s;
+		s << name << e.value << "/" << cth_event_count() << " ";
+		trace += s.str();
+	};
+
+	std::string trace;
+};
+
+
+int main(int argc, char **argv)
+{
+	Flooded f;
+
+	f.cthsmQueueEvent(E6(E6::EV_PLAIN, 1));
+	f.cthsmQueueEvent(E6(E6::EV_LATEST, 1));
+	f.cthsmQueueEvent(E6(E6::EV_ONCE, 1));
+	f.cthsmQueueEvent(E6(E6::EV_COUNT, 1));
+	f.cthsmQueueEvent(E6(E6::EV_PLAIN, 2));
+	f.cthsmQueueEvent(E6(E6::EV_LATEST, 2));
+	f.cthsmQueueEvent(E6(E6::EV_ONCE, 2));
+	f.cthsmQueueEvent(E6(E6::EV_COUNT, 2));
+	f.cthsmQueueEvent(E6(E6::EV_LATEST, 3));
+	f.cthsmQueueEvent(E6(E6::EV_COUNT, 3));
+	CHECK( ! f.cthsmRun() );
+	// PLAIN events are all handled.  LATEST is handled once, in the
+	// first one's place, with the last value.  ONCE is the first one.
+	// COUNT is the first one, standing for three.
+	std::string expected = "P1/1 L3/1 O1/1 C1/3 P2/1 ";
+	CHECK( f.trace == expected );
+	if (f.trace != expected)
+		std::cerr << "trace is \"" << f.trace << "\"\n";
+
+	// Once handled, the next event of each kind is queued again.
+	f.trace = "";
+	f.cthsmQueueEvent(E6(E6::EV_ONCE, 4));
+	f.cthsmQueueEvent(E6(E6::EV_COUNT, 4));
+	f.cthsmQueueEvent(E6(E6::EV_ONCE, 5));
+	CHECK( ! f.cthsmRun() );
+	expected = "O4/1 C4/1 ";
+	CHECK( f.trace == expected );
+	if (f.trace != expected)
+		std::cerr << "trace is \"" << f.trace << "\"\n";
+
+	// With a budget, merging still works on events left in the queue.
+	f.trace = "";
+	f.cthsmSetBudget(1);
+	f.cthsmQueueEvent(E6(E6::EV_PLAIN, 6));
+	f.cthsmQueueEvent(E6(E6::EV_LATEST, 6));
+	CHECK( f.cthsmRun() );
+	f.cthsmQueueEvent(E6(E6::EV_LATEST, 7));
+	CHECK( ! f.cthsmRun() );
+	expected = "P6/1 L7/1 ";
+	CHECK( f.trace == expected );
+	if (f.trace != expected)
+		std::cerr << "trace is \"" << f.trace << "\"\n";
+
+	return checkStatus();
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+
+. ./testlibrary.sh
+
+test_header "Hierarchy validation"
+
+do_this_test && {
+	(
+	cd t04 &&
+	run_test "validate hierarchies" ./test1.sh 0 :
+	)
+}
+
+do_this_test && {
+	(
+	cd t04 &&
+	run_test "abort on a broken hierarchy" ./test2.sh 134 :
+	)
+}
+
+do_this_test && {
+	(
+	cd t04 &&
+	run_test "assert on a broken transition" ./test3.sh 134 :
+	)
+}
+
+test_trailer
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+# cthsmStart() must abort on a broken hierarchy, even with NDEBUG.
+make validate-ndebug >/dev/null || exit 1
+./validate-ndebug abort 2>/dev/null
@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# A transition to an unregistered state above which the hierarchy is
+# broken must fail an assertion, not loop forever.
+make validate >/dev/null || exit 1
+timeout 10 ./validate stray 2>/dev/null
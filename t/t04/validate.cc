@@ -0,0 +1,176 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "cthsm.hh"
+#include "../check.hh"
+#include <iostream>
+#include <cstring>
+
+using namespace CTHSM;
+
+
+class E5 : public Event {
+public:
+	E5(int n) : Event(n) { };
+	enum {
+		EV_GO = CTHE_USER,
+		EV_STRAY,
+	};
+};
+
+
+/**
+ * An HSM with a deliberately broken hierarchy, depending on how it is
+ * constructed.  None of these call cthsmStart() in the constructor, so the
+ * test can look at the hierarchy first.
+ */
+class Shapes : public CTHsm<Shapes, E5> {
+public:
+	enum Shape {
+		GOOD,
+		CYCLE,
+		TWO_TOPS,
+		TOO_DEEP,
+		JUST_DEEP_ENOUGH,
+	};
+
+	Shapes(Shape shape) : CTHsm<Shapes,E5>(initial(shape)), entries(0)
+	{
+		if (shape == GOOD) {
+			cthsmRegister(&Shapes::a);
+			cthsmRegister(&Shapes::b);
+		}
+		if (shape == TWO_TOPS) {
+			cthsmRegister(&Shapes::orphan);
+		}
+	};
+
+	static State initial(Shape shape) {
+		switch (shape) {
+		case GOOD:
+			return &Shapes::a;
+		case CYCLE:
+			return &Shapes::loop1;
+		case TWO_TOPS:
+			return &Shapes::a;
+		case TOO_DEEP:
+			return &Shapes::level<0>;
+		case JUST_DEEP_ENOUGH:
+			return &Shapes::level<2>;
+		}
+		return 0;
+	};
+
+	void start() {
+		cthsmStart();
+	};
+
+	CTHsmState a(E5 e) {
+		switch (e.event()) {
+		case E5::CTHE_ENTRY:
+			entries++;
+			return cth_handled();
+		case E5::EV_GO:
+			return cth_transition(&Shapes::b);
+		case E5::EV_STRAY:
+			// loop1 is not registered, so cthsmStart() can't
+			// find the cycle above it.
+			return cth_transition(&Shapes::loop1);
+		default:
+			return cth_parent(&Shapes::topState);
+		}
+	};
+
+	CTHsmState b(E5 e) {
+		switch (e.event()) {
+		case E5::CTHE_ENTRY:
+			entries++;
+			return cth_handled();
+		default:
+			return cth_parent(&Shapes::topState);
+		}
+	};
+
+	CTHsmState loop1(E5 e) {
+		return cth_parent(&Shapes::loop2);
+	};
+
+	CTHsmState loop2(E5 e) {
+		return cth_parent(&Shapes::loop1);
+	};
+
+	/** Another top state. */
+	CTHsmState orphan(E5 e) {
+		return CTH_I_AM_THE_TOP_STATE;
+	};
+
+	/**
+	 * A chain of states.  level<N> is the child of level<N+1>, and
+	 * level<11> is the top state, so level<0> is 12 deep.
+	 */
+	template<int N>
+	CTHsmState level(E5 e) {
+		if (N == 11)
+			return CTH_I_AM_THE_TOP_STATE;
+		return cth_parent(&Shapes::level<(N < 11 ? N + 1 : N)>);
+	};
+
+	int entries;
+};
+
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && 0 == strcmp(argv[1], "abort")) {
+		Shapes s(Shapes::CYCLE);
+		s.start();
+		// Not reached.
+		return 0;
+	}
+	if (argc > 1 && 0 == strcmp(argv[1], "stray")) {
+		Shapes s(Shapes::GOOD);
+		s.start();
+		s.sendEvent(E5(E5::EV_STRAY));
+		// Not reached.
+		return 0;
+	}
+
+	{
+		Shapes s(Shapes::GOOD);
+		CHECK( s.cthsmValidate() == 0 );
+		s.start();
+		CHECK( s.entries == 1 );
+		s.sendEvent(E5(E5::EV_GO));
+		CHECK( s.entries == 2 );
+		CHECK( s.cthsmInState(&Shapes::b) );
+	}
+	{
+		Shapes s(Shapes::CYCLE);
+		const char* error = s.cthsmValidate();
+		CHECK( error && strstr(error, "cycle") );
+	}
+	{
+		Shapes s(Shapes::TWO_TOPS);
+		const char* error = s.cthsmValidate();
+		CHECK( error && strstr(error, "top") );
+	}
+	{
+		Shapes s(Shapes::TOO_DEEP);
+		const char* error = s.cthsmValidate();
+		CHECK( error && strstr(error, "MAX_DEPTH") );
+	}
+	{
+		// level<2> to level<11> is ten states.
+		Shapes s(Shapes::JUST_DEEP_ENOUGH);
+		CHECK( s.cthsmValidate() == 0 );
+		s.start();
+	}
+
+	return checkStatus();
+}
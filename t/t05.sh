@@ -0,0 +1,14 @@
+#!/bin/sh
+
+. ./testlibrary.sh
+
+test_header "Executors"
+
+do_this_test && {
+	(
+	cd t05 &&
+	run_test "epoll executor" ./test1.sh 0 :
+	)
+}
+
+test_trailer
@@ -0,0 +1,166 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "cthsm_epoll.hh"
+#include "../check.hh"
+#include <iostream>
+#include <cerrno>
+#include <thread>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+using namespace CTHSM;
+
+
+class IoEvent : public Event {
+public:
+	IoEvent(int n) : Event(n), fd(-1) { };
+	IoEvent(int n, int fd) : Event(n), fd(fd) { };
+	enum {
+		EV_READABLE = CTHE_USER,
+		EV_TICK,
+	};
+	int fd;
+};
+
+
+IoEvent readable(int fd, uint32_t revents)
+{
+	return IoEvent(IoEvent::EV_READABLE, fd);
+}
+
+
+/**
+ * Reads everything it can from a file descriptor each time it is told the
+ * file descriptor is readable.  Then sends itself some EV_TICKs, so we can
+ * see the budget working.
+ */
+class Reader : public CTHsm<Reader, IoEvent> {
+public:
+	Reader(int ticks = 0) : CTHsm<Reader,IoEvent>(&Reader::reading),
+				ticksPerRead(ticks), reads(0), bytes(0),
+				ticks(0)
+	{
+		cthsmStart();
+	};
+
+	CTHsmState reading(IoEvent e) {
+		switch (e.event()) {
+		case IoEvent::EV_READABLE: {
+			char buf[64];
+			ssize_t n;
+			reads++;
+			while ((n = read(e.fd, buf, sizeof(buf))) > 0)
+				bytes += n;
+			for (int i = 0; i < ticksPerRead; i++)
+				sendEvent(IoEvent(IoEvent::EV_TICK));
+			return cth_handled();
+		}
+		case IoEvent::EV_TICK:
+			ticks++;
+			return cth_handled();
+		default:
+			return cth_parent(&Reader::topState);
+		}
+	};
+
+	int ticksPerRead;
+	int reads;
+	int bytes;
+	int ticks;
+};
+
+
+static void nonblocking(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+static void put(int fd, const char* s, int n)
+{
+	CHECK( write(fd, s, n) == n );
+}
+
+
+int main(int argc, char **argv)
+{
+	// Don't hang forever if the executor blocks when it should not.
+	alarm(10);
+
+	int p[2];
+	int s[2];
+	CHECK( pipe(p) == 0 );
+	CHECK( socketpair(AF_UNIX, SOCK_STREAM, 0, s) == 0 );
+	nonblocking(p[0]);
+	nonblocking(s[0]);
+
+	EpollExecutor ex;
+	Reader r1, r2;
+	CHECK( ex.watch(p[0], EPOLLIN, &r1, readable) );
+	CHECK( ex.watch(s[0], EPOLLIN, &r2, readable) );
+
+	// Nothing is ready.
+	CHECK( ex.runOnce(0) == 0 );
+	CHECK( r1.reads == 0 && r2.reads == 0 );
+
+	// Several writes, one wakeup, one event for each HSM.
+	put(p[1], "abc", 3);
+	put(p[1], "defg", 4);
+	put(s[1], "hi", 2);
+	CHECK( ex.runOnce(0) == 2 );
+	CHECK( r1.reads == 1 && r1.bytes == 7 );
+	CHECK( r2.reads == 1 && r2.bytes == 2 );
+	CHECK( ! ex.ready() );
+
+	// An HSM with a budget does not hog the loop.
+	ex.unwatch(s[0]);
+	Reader r3(5);
+	r3.cthsmSetBudget(2);
+	CHECK( ex.watch(s[0], EPOLLIN, &r3, readable) );
+	put(s[1], "x", 1);
+	CHECK( ex.runOnce(0) == 1 );
+	// The read event and one tick.
+	CHECK( r3.reads == 1 && r3.ticks == 1 );
+	CHECK( ex.ready() );
+	// r3 still has work, so this must not block.
+	CHECK( ex.runOnce(-1) == 0 );
+	CHECK( r3.ticks == 3 );
+	CHECK( ex.runOnce(-1) == 0 );
+	CHECK( r3.ticks == 5 );
+	CHECK( ! ex.ready() );
+
+	// run() until another thread stops us.
+	std::thread writer([&]() {
+		put(p[1], "12345", 5);
+		ex.stop();
+	});
+	ex.run();
+	writer.join();
+	// The data was written before the stop, so it was seen first.
+	CHECK( r1.reads == 2 && r1.bytes == 12 );
+
+	// A failed epoll_wait() (no room for any events) is reported, and
+	// makes run() return.
+	EpollExecutor broken(0);
+	CHECK( broken.error() == 0 );
+	CHECK( broken.runOnce(0) == -1 );
+	CHECK( broken.error() == EINVAL );
+	broken.run();
+	CHECK( broken.error() == EINVAL );
+
+	ex.unwatch(p[0]);
+	ex.unwatch(s[0]);
+	close(p[0]);
+	close(p[1]);
+	close(s[0]);
+	close(s[1]);
+
+	return checkStatus();
+}
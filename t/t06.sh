@@ -0,0 +1,21 @@
+#!/bin/sh
+
+. ./testlibrary.sh
+
+test_header "Profiler"
+
+do_this_test && {
+	(
+	cd t06 &&
+	run_test "transition profile" ./test1.sh 0 :
+	)
+}
+
+do_this_test && {
+	(
+	cd t06 &&
+	run_test "profiled HSM behaves the same" ./test2.sh 0 :
+	)
+}
+
+test_trailer
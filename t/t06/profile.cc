@@ -0,0 +1,86 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Profile the TestHSM from t01, whose parent queries, exits and entries we
+ * already know from t01/saved-output.
+ */
+
+#include "t1.hh"
+#include "../check.hh"
+#include <iostream>
+#include <sstream>
+
+
+static void checkTransition(const TestHSM::StateProfile::Transition* t,
+			    unsigned long parents, unsigned long exits,
+			    unsigned long entries)
+{
+	CHECK( t );
+	if (! t)
+		return;
+	CHECK( t->count == 1 );
+	CHECK( t->timed == 1 );
+	CHECK( t->parents == parents );
+	CHECK( t->exits == exits );
+	CHECK( t->entries == entries );
+}
+
+
+int main(int argc, char **argv)
+{
+	// TestHSM talks a lot.
+	std::ostringstream chatter;
+	std::streambuf* cout = std::cout.rdbuf(chatter.rdbuf());
+
+	std::ostringstream report;
+	{
+		TestHSM th;
+		th.cthsmProfileName(&TestHSM::leftBranch1, "leftBranch1");
+		th.cthsmProfileName(&TestHSM::leftBranch2, "leftBranch2");
+		th.cthsmProfileName(&TestHSM::rightBranch3, "rightBranch3");
+		th.cthsmProfileName(&TestHSM::topState, "topState");
+		th.cthsmProfileReportOnExit(&report);
+
+		th.sendEvent(TestEvent(TestEvent::TE_THREE));
+		th.sendEvent(TestEvent(TestEvent::TE_BACK));
+		th.sendEvent(TestEvent(TestEvent::TE_BACKAGAIN));
+
+		const TestHSM::StateProfile& p = th.cthsmProfile();
+		checkTransition(p.transition(&TestHSM::leftBranch2,
+					     &TestHSM::rightBranch3), 6, 2, 3);
+		checkTransition(p.transition(&TestHSM::rightBranch3,
+					     &TestHSM::leftBranch1), 6, 3, 1);
+		checkTransition(p.transition(&TestHSM::leftBranch1,
+					     &TestHSM::rightBranch3), 6, 1, 3);
+		CHECK( p.transition(&TestHSM::leftBranch1,
+				    &TestHSM::leftBranch2) == 0 );
+
+		// TE_BACKAGAIN is handled by commonState, one up from
+		// leftBranch1.
+		const TestHSM::StateProfile::Dispatch* d;
+		d = p.dispatch(&TestHSM::leftBranch1, TestEvent::TE_BACKAGAIN);
+		CHECK( d && d->count == 1 && d->bubbles == 1 );
+		d = p.dispatch(&TestHSM::leftBranch2, TestEvent::TE_THREE);
+		CHECK( d && d->count == 1 && d->bubbles == 0 );
+	}
+	std::cout.rdbuf(cout);
+
+	std::string r = report.str();
+	CHECK( r.find("CTHsm profile: transitions") != std::string::npos );
+	CHECK( r.find("CTHsm profile: dispatches") != std::string::npos );
+	CHECK( r.find("leftBranch2 -> rightBranch3") != std::string::npos );
+	CHECK( r.find("rightBranch3 -> leftBranch1") != std::string::npos );
+	// The exits when th was destroyed.
+	CHECK( r.find("rightBranch3 -> topState") != std::string::npos );
+	if (errors)
+		std::cerr << r;
+
+	return checkStatus();
+}
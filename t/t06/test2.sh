@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# Profiling must not change what the HSM does.
+set -e
+make t1prof
+diff -q ../t01/saved-output <(./t1prof)
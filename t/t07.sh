@@ -0,0 +1,14 @@
+#!/bin/sh
+
+. ./testlibrary.sh
+
+test_header "Channels"
+
+do_this_test && {
+	(
+	cd t07 &&
+	run_test "SPSC channels" ./test1.sh 0 :
+	)
+}
+
+test_trailer
@@ -0,0 +1,146 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "cthsm_channel.hh"
+#include "../check.hh"
+#include <iostream>
+#include <thread>
+
+using namespace CTHSM;
+
+
+class SeqEvent : public Event {
+public:
+	SeqEvent(int n) : Event(n), from(0), seq(0) { };
+	SeqEvent(int n, int from, unsigned long seq)
+		: Event(n), from(from), seq(seq) { };
+	enum {
+		EV_ITEM = CTHE_USER,
+	};
+	int from;
+	unsigned long seq;
+};
+
+
+/**
+ * Checks that events from each sender arrive in order.
+ */
+class Sink : public CTHsm<Sink, SeqEvent> {
+public:
+	Sink() : CTHsm<Sink,SeqEvent>(&Sink::receiving), received(0),
+		 disorder(0)
+	{
+		next[0] = next[1] = 0;
+		cthsmStart();
+	};
+
+	CTHsmState receiving(SeqEvent e) {
+		switch (e.event()) {
+		case SeqEvent::EV_ITEM:
+			if (e.seq != next[e.from])
+				disorder++;
+			next[e.from] = e.seq + 1;
+			received++;
+			return cth_handled();
+		default:
+			return cth_parent(&Sink::topState);
+		}
+	};
+
+	unsigned long next[2];
+	unsigned long received;
+	unsigned long disorder;
+};
+
+
+/** Collects popped events, for the single threaded tests. */
+struct Collect {
+	Collect() : n(0), last(0) { };
+	void operator()(const SeqEvent& e) {
+		n++;
+		last = e.seq;
+	};
+	unsigned n;
+	unsigned long last;
+};
+
+
+int main(int argc, char **argv)
+{
+	// Batched publication, in one thread.
+	{
+		SpscChannel<SeqEvent, 8, 4> c;
+		Collect got;
+		CHECK( c.push(SeqEvent(SeqEvent::EV_ITEM, 0, 1)) );
+		CHECK( c.push(SeqEvent(SeqEvent::EV_ITEM, 0, 2)) );
+		// Not published yet.
+		CHECK( c.pop(got, 100) == 0 );
+		c.flush();
+		CHECK( c.pop(got, 100) == 2 );
+		CHECK( got.last == 2 );
+		// The fourth push publishes the batch.
+		for (unsigned long i = 3; i <= 6; i++)
+			CHECK( c.push(SeqEvent(SeqEvent::EV_ITEM, 0, i)) );
+		CHECK( c.pop(got, 100) == 4 );
+		// Fill it up.
+		for (unsigned long i = 7; i <= 14; i++)
+			CHECK( c.push(SeqEvent(SeqEvent::EV_ITEM, 0, i)) );
+		CHECK( ! c.push(SeqEvent(SeqEvent::EV_ITEM, 0, 15)) );
+		// A failed push publishes what is there.
+		CHECK( c.pop(got, 3) == 3 );
+		CHECK( got.last == 9 );
+		CHECK( c.push(SeqEvent(SeqEvent::EV_ITEM, 0, 15)) );
+		c.flush();
+		CHECK( c.pop(got, 100) == 6 );
+		CHECK( got.last == 15 );
+		CHECK( c.empty() );
+		// Leave some behind for the destructor.
+		c.push(SeqEvent(SeqEvent::EV_ITEM, 0, 16));
+	}
+
+	// Two producer threads feeding one HSM.
+	{
+		const unsigned long COUNT = 200000;
+		typedef ChannelInbox<Sink, SeqEvent> Inbox;
+		Inbox::Channel* c0 = new Inbox::Channel;
+		Inbox::Channel* c1 = new Inbox::Channel;
+		Sink sink;
+		Inbox inbox(&sink);
+		inbox.add(c0);
+		inbox.add(c1);
+
+		std::thread p0([&]() {
+			for (unsigned long i = 0; i < COUNT; i++) {
+				SeqEvent e(SeqEvent::EV_ITEM, 0, i);
+				while (! c0->push(e))
+					std::this_thread::yield();
+			}
+			c0->flush();
+		});
+		std::thread p1([&]() {
+			for (unsigned long i = 0; i < COUNT; i++) {
+				SeqEvent e(SeqEvent::EV_ITEM, 1, i);
+				while (! c1->push(e))
+					std::this_thread::yield();
+			}
+			c1->flush();
+		});
+		while (sink.received < 2 * COUNT)
+			inbox.poll();
+		p0.join();
+		p1.join();
+		CHECK( sink.received == 2 * COUNT );
+		CHECK( sink.disorder == 0 );
+		CHECK( sink.next[0] == COUNT && sink.next[1] == COUNT );
+		delete c0;
+		delete c1;
+	}
+
+	return checkStatus();
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+
+. ./testlibrary.sh
+
+test_header "Differential fuzzing"
+
+do_this_test && {
+	(
+	cd t08 &&
+	run_test "random machines, all engines" ./test1.sh 0 :
+	)
+}
+
+test_trailer
@@ -0,0 +1,260 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Engines that run a Spec on CTHsm itself.
+ */
+
+#include "fuzz.hh"
+#include "cthsm.hh"
+#include "cthsm_fleet.hh"
+
+using namespace CTHSM;
+
+
+class FuzzEvent : public Event {
+public:
+	FuzzEvent(int n) : Event(n) { };
+};
+
+
+/**
+ * An HSM whose hierarchy and reactions come from a Spec.
+ *
+ * State functions have to exist at compile time, so there is a pool of
+ * FUZZ_MAX_STATES of them, st<0> to st<15>, and each one looks up what to
+ * do in the Spec.  st<0> is always the top state.
+ */
+class FuzzHsm : public CTHsm<FuzzHsm, FuzzEvent> {
+public:
+	FuzzHsm(const Spec& spec, Trace& trace)
+		: CTHsm<FuzzHsm,FuzzEvent>(states[spec.initial]),
+		  _spec(spec), _trace(trace), _actionState(0), _action(0)
+	{
+		for (int i = 1; i < spec.nstates; i++)
+			cthsmRegister(states[i]);
+		cthsmStart();
+	};
+
+	template<int N>
+	CTHsmState st(FuzzEvent e) {
+		return state(N, e);
+	};
+
+private:
+	CTHsmState state(int n, FuzzEvent e) {
+		switch (e.event()) {
+		case FuzzEvent::CTHE_PARENT:
+			if (n == 0)
+				return CTH_I_AM_THE_TOP_STATE;
+			return cth_parent(states[_spec.parent[n]]);
+		case FuzzEvent::CTHE_ENTRY:
+			_trace.push_back(traceItem(TR_ENTRY, n));
+			return cth_handled();
+		case FuzzEvent::CTHE_EXIT:
+			_trace.push_back(traceItem(TR_EXIT, n));
+			return cth_handled();
+		}
+
+		int ev = e.event() - FuzzEvent::CTHE_USER;
+		const Reaction& r = _spec.react[n][ev];
+		if (r.kind == Reaction::PARENT) {
+			if (n != 0)
+				return cth_parent(states[_spec.parent[n]]);
+			_trace.push_back(traceItem(TR_DROPPED, 0, ev));
+			return cth_handled();
+		}
+
+		_trace.push_back(traceItem(TR_HANDLED, n, ev));
+		for (int i = 0; r.post >= 0 && i < r.posts; i++)
+			cth_post(FuzzEvent(FuzzEvent::CTHE_USER + r.post));
+		if (r.send >= 0)
+			sendEvent(FuzzEvent(FuzzEvent::CTHE_USER + r.send));
+		if (r.kind == Reaction::HANDLE)
+			return cth_handled();
+		if (r.action < 0)
+			return cth_transition(states[r.target]);
+		_actionState = n;
+		_action = r.action;
+		return cth_transition(states[r.target], &FuzzHsm::act);
+	};
+
+	void act() {
+		_trace.push_back(traceItem(TR_ACTION, _actionState, _action));
+	};
+
+	static const State states[FUZZ_MAX_STATES];
+
+	const Spec& _spec;
+	Trace& _trace;
+	/** The state and id of the pending transition action. */
+	int _actionState;
+	int _action;
+};
+
+
+const FuzzHsm::State FuzzHsm::states[FUZZ_MAX_STATES] = {
+	&FuzzHsm::st<0>,  &FuzzHsm::st<1>,  &FuzzHsm::st<2>,  &FuzzHsm::st<3>,
+	&FuzzHsm::st<4>,  &FuzzHsm::st<5>,  &FuzzHsm::st<6>,  &FuzzHsm::st<7>,
+	&FuzzHsm::st<8>,  &FuzzHsm::st<9>,  &FuzzHsm::st<10>, &FuzzHsm::st<11>,
+	&FuzzHsm::st<12>, &FuzzHsm::st<13>, &FuzzHsm::st<14>, &FuzzHsm::st<15>,
+};
+
+
+class CTHsmEngine : public Engine {
+public:
+	const char* name() {
+		return "cthsm";
+	};
+
+	void run(const Spec& spec, const std::vector<int>& events,
+		 Trace& trace) {
+		FuzzHsm hsm(spec, trace);
+		for (unsigned i = 0; i < events.size(); i++)
+			hsm.sendEvent(FuzzEvent(FuzzEvent::CTHE_USER + events[i]));
+	};
+};
+
+
+/**
+ * Queues each event and runs the HSM one event at a time, so every event
+ * sent from inside a state goes through the budget path in cthsmRun().
+ */
+class BudgetEngine : public Engine {
+public:
+	const char* name() {
+		return "budget";
+	};
+
+	void run(const Spec& spec, const std::vector<int>& events,
+		 Trace& trace) {
+		FuzzHsm hsm(spec, trace);
+		hsm.cthsmSetBudget(1);
+		for (unsigned i = 0; i < events.size(); i++) {
+			hsm.cthsmQueueEvent(
+				FuzzEvent(FuzzEvent::CTHE_USER + events[i]));
+			while (hsm.cthsmRun())
+				;
+		}
+	};
+};
+
+
+/**
+ * Runs COPIES machines, each fed the whole event sequence, with copy k
+ * starting k events behind copy 0.  At each step the copies are grouped by
+ * the event they need next, and each group is sent its event in bulk.
+ * Being at different points in the sequence, the copies are in different
+ * states, so the bulk sends have several transition groups to deal with.
+ *
+ * The trace is copy 0's, followed by a TR_DIVERGED item for each copy
+ * whose trace is not the same.
+ */
+class StaggeredEngine : public Engine {
+public:
+	static const unsigned COPIES = 8;
+
+	unsigned copies() {
+		return COPIES;
+	};
+
+	void run(const Spec& spec, const std::vector<int>& events,
+		 Trace& trace) {
+		std::vector<Trace> traces(COPIES);
+		std::vector<FuzzHsm*> hsms;
+		for (unsigned k = 0; k < COPIES; k++)
+			hsms.push_back(new FuzzHsm(spec, traces[k]));
+
+		int nevents = events.size();
+		std::vector<FuzzHsm*> group;
+		for (int step = 0; step < nevents + int(COPIES) - 1; step++) {
+			for (int e = 0; e < FUZZ_EVENTS; e++) {
+				group.clear();
+				for (int k = 0; k < int(COPIES); k++) {
+					int i = step - k;
+					if (i >= 0 && i < nevents && events[i] == e)
+						group.push_back(hsms[k]);
+				}
+				if (group.size())
+					send(group, FuzzEvent(
+						     FuzzEvent::CTHE_USER + e));
+			}
+		}
+
+		for (unsigned k = 0; k < COPIES; k++)
+			delete hsms[k];
+		trace.insert(trace.end(), traces[0].begin(), traces[0].end());
+		for (unsigned k = 1; k < COPIES; k++) {
+			if (traces[k] != traces[0])
+				trace.push_back(traceItem(TR_DIVERGED, 0, k));
+		}
+	};
+
+protected:
+	virtual void send(std::vector<FuzzHsm*>& hsms, FuzzEvent e) = 0;
+};
+
+
+class BulkEngine : public StaggeredEngine {
+public:
+	const char* name() {
+		return "bulk";
+	};
+
+protected:
+	void send(std::vector<FuzzHsm*>& hsms, FuzzEvent e) {
+		FuzzHsm::cthsmBulkSend(&hsms[0], hsms.size(), e);
+	};
+};
+
+
+/**
+ * A Fleet with tiny chunks, so that even small groups are split between
+ * threads.
+ */
+class FleetEngine : public StaggeredEngine {
+public:
+	FleetEngine() : _fleet(2, 2) { };
+
+	const char* name() {
+		return "fleet";
+	};
+
+protected:
+	void send(std::vector<FuzzHsm*>& hsms, FuzzEvent e) {
+		_fleet.sendEvent(hsms, e);
+	};
+
+private:
+	Fleet<FuzzHsm, FuzzEvent> _fleet;
+};
+
+
+Engine* makeCTHsmEngine()
+{
+	return new CTHsmEngine;
+}
+
+
+Engine* makeBudgetEngine()
+{
+	return new BudgetEngine;
+}
+
+
+Engine* makeBulkEngine()
+{
+	return new BulkEngine;
+}
+
+
+Engine* makeFleetEngine()
+{
+	return new FleetEngine;
+}
@@ -0,0 +1,281 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Run random machines through every engine and compare the traces.
+ *
+ * Usage: fuzz [cases [events [seed]]]
+ *
+ * Each case is a new random machine and a new random event sequence.  On
+ * the first mismatch we print the machine, the first differing trace items
+ * and the case's seed, and exit with status 1.  "fuzz 1 <events> <seed>"
+ * repeats just that case.  At the end we print the throughput of each
+ * engine.
+ *
+ * To check a new engine, write a make function for it and add it to the
+ * list in main().
+ */
+
+#include "fuzz.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+typedef std::mt19937 Random;
+
+
+std::string traceItemString(int32_t item)
+{
+	int kind = item >> 24;
+	int state = (item >> 12) & 0xfff;
+	int arg = item & 0xfff;
+	std::ostringstream s;
+	switch (kind) {
+	case TR_ENTRY:   s << "entry " << state; break;
+	case TR_EXIT:    s << "exit " << state; break;
+	case TR_ACTION:  s << "action " << state << ":" << arg; break;
+	case TR_HANDLED: s << "handled " << state << ":e" << arg; break;
+	case TR_DROPPED: s << "dropped e" << arg; break;
+	case TR_DIVERGED: s << "copy " << arg << " differs"; break;
+	default:         s << "? " << item; break;
+	}
+	return s.str();
+}
+
+
+/**
+ * A number from 0 to n-1.  We don't use the std distributions because
+ * their output is allowed to differ between library versions, and a seed
+ * must always give the same case.
+ */
+static int pick(Random& random, int n)
+{
+	return random() % n;
+}
+
+
+/**
+ * An event to post or send while handling event e, or -1.  These are
+ * always later events than e, so a cascade of them always ends.
+ */
+static int later(Random& random, int e, int percent)
+{
+	if (e == FUZZ_EVENTS - 1 || pick(random, 100) >= percent)
+		return -1;
+	return e + 1 + pick(random, FUZZ_EVENTS - 1 - e);
+}
+
+
+/**
+ * The most copies of one event posted at once.  More than CTHsm's
+ * MAX_INTERNAL_EVENTS, so bursts go past its buffer.
+ */
+static const int MAX_BURST = 12;
+
+
+/**
+ * How many copies of post to post.  Only the last two events come in
+ * bursts, so a burst can set off at most MAX_BURST more bursts.
+ */
+static int burst(Random& random, int post)
+{
+	if (post < FUZZ_EVENTS - 2 || pick(random, 100) >= 25)
+		return 1;
+	return 2 + pick(random, MAX_BURST - 1);
+}
+
+
+static void generate(Random& random, Spec& spec)
+{
+	int depth[FUZZ_MAX_STATES];
+
+	spec.nstates = 2 + pick(random, FUZZ_MAX_STATES - 1);
+	spec.parent[0] = -1;
+	depth[0] = 0;
+	for (int s = 1; s < spec.nstates; s++) {
+		int p = pick(random, s);
+		// Keep well inside CTHsm's MAX_DEPTH.
+		if (depth[p] >= 8)
+			p = 0;
+		spec.parent[s] = p;
+		depth[s] = depth[p] + 1;
+	}
+	spec.initial = 1 + pick(random, spec.nstates - 1);
+
+	for (int s = 0; s < spec.nstates; s++) {
+		for (int e = 0; e < FUZZ_EVENTS; e++) {
+			Reaction& r = spec.react[s][e];
+			r.target = -1;
+			r.action = -1;
+			r.post = -1;
+			r.posts = 0;
+			r.send = -1;
+			int k = pick(random, 100);
+			// The top state mostly drops events, but sometimes
+			// handles them or transitions from the top.
+			if (k < (s == 0 ? 70 : 40)) {
+				r.kind = Reaction::PARENT;
+				continue;
+			}
+			if (k < 65) {
+				r.kind = Reaction::HANDLE;
+			} else {
+				r.kind = Reaction::TRANSITION;
+				// Sometimes to the top state.
+				r.target = pick(random, spec.nstates);
+				if (pick(random, 2))
+					r.action = pick(random, 100);
+			}
+			r.post = later(random, e, 20);
+			r.posts = burst(random, r.post);
+			r.send = later(random, e, 10);
+		}
+	}
+}
+
+
+static void print(std::ostream& out, const Spec& spec)
+{
+	out << "states " << spec.nstates << ", initial " << spec.initial
+	    << "\n";
+	for (int s = 0; s < spec.nstates; s++) {
+		out << "  " << s << " (parent " << spec.parent[s] << "):";
+		for (int e = 0; e < FUZZ_EVENTS; e++) {
+			const Reaction& r = spec.react[s][e];
+			out << " e" << e << "=";
+			switch (r.kind) {
+			case Reaction::PARENT:
+				out << "^";
+				break;
+			case Reaction::HANDLE:
+				out << "h";
+				break;
+			case Reaction::TRANSITION:
+				out << "t" << r.target;
+				if (r.action >= 0)
+					out << "/a" << r.action;
+				break;
+			}
+			if (r.post >= 0)
+				out << "+p" << r.post;
+			if (r.post >= 0 && r.posts > 1)
+				out << "x" << r.posts;
+			if (r.send >= 0)
+				out << "+s" << r.send;
+		}
+		out << "\n";
+	}
+}
+
+
+/**
+ * \return true if the traces are the same.  Otherwise print the first
+ * difference.
+ */
+static bool compare(const Trace& ref, const Trace& t, const char* name)
+{
+	unsigned i;
+	for (i = 0; i < ref.size() && i < t.size(); i++) {
+		if (ref[i] != t[i])
+			break;
+	}
+	if (i == ref.size() && i == t.size())
+		return true;
+
+	std::cerr << name << ": trace differs at item " << i << " of "
+		  << ref.size() << "\n";
+	unsigned from = i > 4 ? i - 4 : 0;
+	for (unsigned j = from; j < i + 4; j++) {
+		std::cerr << (j == i ? "> " : "  ") << j << ":";
+		if (j < ref.size())
+			std::cerr << " " << traceItemString(ref[j]);
+		else
+			std::cerr << " (end)";
+		std::cerr << "  |  ";
+		if (j < t.size())
+			std::cerr << traceItemString(t[j]);
+		else
+			std::cerr << "(end)";
+		std::cerr << "\n";
+	}
+	return false;
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned cases = 2000;
+	unsigned nevents = 200;
+	unsigned long seed = 1;
+	if (argc > 1)
+		cases = strtoul(argv[1], 0, 0);
+	if (argc > 2)
+		nevents = strtoul(argv[2], 0, 0);
+	if (argc > 3)
+		seed = strtoul(argv[3], 0, 0);
+
+	// The first engine is the reference.
+	std::vector<Engine*> engines;
+	engines.push_back(makeCTHsmEngine());
+	engines.push_back(makeBudgetEngine());
+	engines.push_back(makeModelEngine());
+	engines.push_back(makeBulkEngine());
+	engines.push_back(makeFleetEngine());
+	engines.push_back(makeTableEngine());
+
+	std::vector<double> seconds(engines.size(), 0.0);
+	Spec spec;
+	std::vector<int> events(nevents);
+	std::vector<Trace> traces(engines.size());
+
+	for (unsigned c = 0; c < cases; c++) {
+		unsigned long caseSeed = seed + c;
+		Random random(caseSeed);
+		generate(random, spec);
+		for (unsigned i = 0; i < nevents; i++)
+			events[i] = pick(random, FUZZ_EVENTS);
+
+		for (unsigned i = 0; i < engines.size(); i++) {
+			traces[i].clear();
+			std::chrono::steady_clock::time_point start =
+				std::chrono::steady_clock::now();
+			engines[i]->run(spec, events, traces[i]);
+			seconds[i] += std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start)
+				.count();
+		}
+
+		for (unsigned i = 1; i < engines.size(); i++) {
+			if (! compare(traces[0], traces[i],
+				      engines[i]->name())) {
+				print(std::cerr, spec);
+				std::cerr << "events:";
+				for (unsigned j = 0; j < nevents; j++)
+					std::cerr << " e" << events[j];
+				std::cerr << "\nrepeat with: " << argv[0]
+					  << " 1 " << nevents << " "
+					  << caseSeed << "\n";
+				return 1;
+			}
+		}
+	}
+
+	printf("%u cases of %u events, all traces match\n", cases, nevents);
+	for (unsigned i = 0; i < engines.size(); i++) {
+		printf("%-8s %8.3f s %10.2f Mevents/s\n", engines[i]->name(),
+		       seconds[i], cases * double(nevents)
+		       * engines[i]->copies() / seconds[i] / 1e6);
+		delete engines[i];
+	}
+	return 0;
+}
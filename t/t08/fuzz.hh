@@ -0,0 +1,137 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef __fuzz_hh__
+#define __fuzz_hh__
+
+/*
+ * Differential testing of HSM engines.
+ *
+ * We generate a random hierarchy and a random set of reactions (handle,
+ * transition with or without an action, post an internal event, send an
+ * external event), then a random sequence of events.  Each engine runs the
+ * same machine on the same events and records a trace of everything
+ * observable: entry and exit actions, transition actions, and which state
+ * handled each event.  The traces from every engine must be identical to
+ * the trace from the reference engine, which is CTHsm itself.
+ */
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * The most states in a generated machine.  FuzzHsm has this many state
+ * functions.
+ */
+#define FUZZ_MAX_STATES 16
+
+/**
+ * The number of user events.  Event numbers start at Event::CTHE_USER.
+ */
+#define FUZZ_EVENTS 6
+
+/**
+ * What a state does with one event.
+ */
+struct Reaction {
+	enum Kind {
+		/** Pass it to the parent state. */
+		PARENT,
+		/** Handle it, and stay in the current state. */
+		HANDLE,
+		/** Handle it, and transition to target. */
+		TRANSITION,
+	};
+	Kind kind;
+	/** The transition target, for TRANSITION. */
+	int target;
+	/** A transition action id, or -1 for none. */
+	int action;
+	/** An event to post internally while handling, or -1. */
+	int post;
+	/** How many copies of post to post. */
+	int posts;
+	/** An event to send (queued externally) while handling, or -1. */
+	int send;
+};
+
+/**
+ * A generated machine.  State 0 is the top state.  Its PARENT reactions
+ * mean that it drops the event.
+ */
+struct Spec {
+	int nstates;
+	int parent[FUZZ_MAX_STATES];
+	int initial;
+	Reaction react[FUZZ_MAX_STATES][FUZZ_EVENTS];
+};
+
+/**
+ * One thing that happened, packed into an int: kind in the top byte, then
+ * state, then event or action.
+ */
+enum TraceKind {
+	TR_ENTRY = 1,
+	TR_EXIT,
+	TR_ACTION,
+	TR_HANDLED,
+	TR_DROPPED,
+	/** An engine running several copies found that they differ. */
+	TR_DIVERGED,
+};
+
+typedef std::vector<int32_t> Trace;
+
+inline int32_t traceItem(int kind, int state, int arg = 0)
+{
+	return (kind << 24) | (state << 12) | arg;
+}
+
+std::string traceItemString(int32_t item);
+
+/**
+ * A way of running a Spec.
+ */
+class Engine {
+public:
+	virtual ~Engine() { };
+	virtual const char* name() = 0;
+
+	/**
+	 * Start the machine, send it each event (numbered from 0 to
+	 * FUZZ_EVENTS-1), then destroy it, appending everything that
+	 * happened to trace.
+	 */
+	virtual void run(const Spec& spec, const std::vector<int>& events,
+			 Trace& trace) = 0;
+
+	/**
+	 * The number of copies of the machine that run() runs, for working
+	 * out throughput.
+	 */
+	virtual unsigned copies() {
+		return 1;
+	};
+};
+
+/** The reference engine: CTHsm, one sendEvent() per event. */
+Engine* makeCTHsmEngine();
+/** CTHsm, fed through cthsmQueueEvent() and a budget of one event. */
+Engine* makeBudgetEngine();
+/** A flat table model with precomputed exit and entry paths. */
+Engine* makeModelEngine();
+/** Staggered copies of CTHsm, fed with CTHsm::cthsmBulkSend(). */
+Engine* makeBulkEngine();
+/** Staggered copies of CTHsm, fed with a two thread Fleet. */
+Engine* makeFleetEngine();
+/** TableHsm, running a StateTable built from the Spec. */
+Engine* makeTableEngine();
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * A model engine that shares no code with CTHsm.
+ *
+ * Before running, it works out from the parent table which state handles
+ * each event in each state, and the exit and entry lists for every
+ * transition, so dispatching is a table lookup.  This is the shape of the
+ * table driven fast paths that are to be checked against CTHsm, and it
+ * encodes the semantics documented at CTHsm::cth_transition() and
+ * CTHsm::transition():
+ *
+ * - a self transition exits and re-enters the state, and does not call the
+ *   transition action;
+ *
+ * - a transition to the top state exits every state, the top state too, and
+ *   a transition from the top state enters every state from the top down,
+ *   and neither calls the transition action;
+ *
+ * - otherwise the common ancestor of the source and destination is neither
+ *   exited nor entered, and that includes a source or destination that is
+ *   itself the common ancestor;
+ *
+ * - internal events are handled after the event that posted them and
+ *   before the next external event.
+ */
+
+#include "fuzz.hh"
+
+#include <deque>
+
+
+class ModelEngine : public Engine {
+public:
+	const char* name() {
+		return "model";
+	};
+
+	void run(const Spec& spec, const std::vector<int>& events,
+		 Trace& trace) {
+		build(spec);
+
+		int state = spec.initial;
+		for (int i = depth[state]; i >= 0; i--)
+			trace.push_back(traceItem(TR_ENTRY, chain[state][i]));
+
+		std::deque<int> external;
+		std::deque<int> internal;
+		for (unsigned i = 0; i < events.size(); i++) {
+			external.push_back(events[i]);
+			while (external.size()) {
+				int e = external.front();
+				external.pop_front();
+				dispatch(spec, state, e, trace, internal,
+					 external);
+				while (internal.size()) {
+					e = internal.front();
+					internal.pop_front();
+					dispatch(spec, state, e, trace,
+						 internal, external);
+				}
+			}
+		}
+
+		for (int i = 0; i <= depth[state]; i++)
+			trace.push_back(traceItem(TR_EXIT, chain[state][i]));
+	};
+
+private:
+	void dispatch(const Spec& spec, int& state, int e, Trace& trace,
+		      std::deque<int>& internal, std::deque<int>& external) {
+		int h = handler[state][e];
+		const Reaction& r = spec.react[h][e];
+		if (r.kind == Reaction::PARENT) {
+			trace.push_back(traceItem(TR_DROPPED, 0, e));
+			return;
+		}
+		trace.push_back(traceItem(TR_HANDLED, h, e));
+		for (int i = 0; r.post >= 0 && i < r.posts; i++)
+			internal.push_back(r.post);
+		if (r.send >= 0)
+			external.push_back(r.send);
+		if (r.kind != Reaction::TRANSITION)
+			return;
+
+		const Path& p = paths[state][r.target];
+		for (unsigned i = 0; i < p.exits.size(); i++)
+			trace.push_back(traceItem(TR_EXIT, p.exits[i]));
+		if (r.action >= 0 && state != r.target && state != 0
+		    && r.target != 0)
+			trace.push_back(traceItem(TR_ACTION, h, r.action));
+		for (unsigned i = 0; i < p.entries.size(); i++)
+			trace.push_back(traceItem(TR_ENTRY, p.entries[i]));
+		state = r.target;
+	};
+
+	/**
+	 * Fill in the tables for spec.
+	 */
+	void build(const Spec& spec) {
+		int n = spec.nstates;
+		for (int s = 0; s < n; s++) {
+			// chain[s] is s, its parent, ..., the top state.
+			depth[s] = 0;
+			chain[s][0] = s;
+			for (int p = s; p != 0; p = spec.parent[p])
+				chain[s][++depth[s]] = spec.parent[p];
+		}
+
+		for (int s = 0; s < n; s++) {
+			for (int e = 0; e < FUZZ_EVENTS; e++) {
+				int h = s;
+				while (h != 0 &&
+				       spec.react[h][e].kind == Reaction::PARENT)
+					h = spec.parent[h];
+				handler[s][e] = h;
+			}
+		}
+
+		for (int src = 0; src < n; src++) {
+			for (int dst = 0; dst < n; dst++) {
+				Path& p = paths[src][dst];
+				p.exits.clear();
+				p.entries.clear();
+				if (src == dst) {
+					p.exits.push_back(src);
+					p.entries.push_back(dst);
+					continue;
+				}
+				if (src == 0) {
+					for (int i = depth[dst]; i >= 0; i--)
+						p.entries.push_back(
+							chain[dst][i]);
+					continue;
+				}
+				if (dst == 0) {
+					for (int i = 0; i <= depth[src]; i++)
+						p.exits.push_back(
+							chain[src][i]);
+					continue;
+				}
+				// Walk the deeper one up to the depth of the
+				// other, then both together, to find the
+				// common ancestor.
+				int a = src;
+				int b = dst;
+				std::vector<int> down;
+				while (depth[a] > depth[b]) {
+					p.exits.push_back(a);
+					a = spec.parent[a];
+				}
+				while (depth[b] > depth[a]) {
+					down.push_back(b);
+					b = spec.parent[b];
+				}
+				while (a != b) {
+					p.exits.push_back(a);
+					a = spec.parent[a];
+					down.push_back(b);
+					b = spec.parent[b];
+				}
+				p.entries.assign(down.rbegin(), down.rend());
+			}
+		}
+	};
+
+	struct Path {
+		std::vector<int> exits;
+		std::vector<int> entries;
+	};
+
+	int depth[FUZZ_MAX_STATES];
+	int chain[FUZZ_MAX_STATES][FUZZ_MAX_STATES];
+	int handler[FUZZ_MAX_STATES][FUZZ_EVENTS];
+	Path paths[FUZZ_MAX_STATES][FUZZ_MAX_STATES];
+};
+
+
+Engine* makeModelEngine()
+{
+	return new ModelEngine;
+}
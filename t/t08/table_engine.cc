@@ -0,0 +1,126 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * An engine that builds a state table from the Spec and runs it with
+ * TableHsm.
+ */
+
+#include "fuzz.hh"
+#include "cthsm_table.hh"
+
+using namespace CTHSM;
+
+
+/*
+ * Action numbers.  Handling actions encode what to post and send, and
+ * transition actions encode the Spec's action id.
+ */
+enum {
+	ACT_ENTRY,
+	ACT_EXIT,
+	ACT_DROPPED,
+	ACT_HANDLED,
+	ACT_TRANSITION = 1000,
+	ACT_COUNT = ACT_TRANSITION + 100,
+};
+
+
+static uint32_t handled(const Reaction& r)
+{
+	return ACT_HANDLED + ((r.posts * (FUZZ_EVENTS + 1) + r.post + 1)
+			      * (FUZZ_EVENTS + 1) + r.send + 1);
+}
+
+
+static void act(TableHsm& hsm, uint32_t id)
+{
+	Trace& trace = *static_cast<Trace*>(hsm.user());
+	int state = hsm.actionState();
+	if (id == ACT_ENTRY) {
+		trace.push_back(traceItem(TR_ENTRY, state));
+	} else if (id == ACT_EXIT) {
+		trace.push_back(traceItem(TR_EXIT, state));
+	} else if (id == ACT_DROPPED) {
+		trace.push_back(traceItem(TR_DROPPED, 0, hsm.event()));
+	} else if (id < ACT_TRANSITION) {
+		trace.push_back(traceItem(TR_HANDLED, state, hsm.event()));
+		int n = id - ACT_HANDLED;
+		int send = n % (FUZZ_EVENTS + 1) - 1;
+		n /= FUZZ_EVENTS + 1;
+		int post = n % (FUZZ_EVENTS + 1) - 1;
+		int posts = n / (FUZZ_EVENTS + 1);
+		for (int i = 0; post >= 0 && i < posts; i++)
+			hsm.post(post);
+		if (send >= 0)
+			hsm.sendEvent(send);
+	} else {
+		trace.push_back(traceItem(TR_ACTION, state,
+					  id - ACT_TRANSITION));
+	}
+}
+
+
+class TableEngine : public Engine {
+public:
+	TableEngine() : _actions() {
+		for (uint32_t id = 0; id < ACT_COUNT; id++)
+			_actions.bind(id, act);
+	};
+
+	const char* name() {
+		return "table";
+	};
+
+	void run(const Spec& spec, const std::vector<int>& events,
+		 Trace& trace) {
+		TableBuilder b(FUZZ_EVENTS);
+		b.state(TABLE_NONE, ACT_ENTRY, ACT_EXIT);
+		for (int s = 1; s < spec.nstates; s++)
+			b.state(spec.parent[s], ACT_ENTRY, ACT_EXIT);
+		for (int s = 0; s < spec.nstates; s++) {
+			for (int e = 0; e < FUZZ_EVENTS; e++) {
+				const Reaction& r = spec.react[s][e];
+				if (s == 0 && r.kind == Reaction::PARENT) {
+					b.handle(0, e, ACT_DROPPED);
+				} else if (r.kind == Reaction::HANDLE) {
+					b.handle(s, e, handled(r));
+				} else if (r.kind == Reaction::TRANSITION) {
+					uint32_t tact = TABLE_NONE;
+					if (r.action >= 0)
+						tact = ACT_TRANSITION
+							+ r.action;
+					b.transition(s, e, r.target, tact,
+						     handled(r));
+				}
+			}
+		}
+		b.initial(spec.initial);
+		std::string bytes = b.build();
+
+		StateTable table;
+		if (table.attach(bytes.data(), bytes.size())) {
+			trace.push_back(traceItem(TR_DIVERGED, 0, 0));
+			return;
+		}
+		TableHsm hsm(table, _actions, &trace);
+		hsm.start();
+		for (unsigned i = 0; i < events.size(); i++)
+			hsm.sendEvent(events[i]);
+	};
+
+private:
+	TableActions _actions;
+};
+
+
+Engine* makeTableEngine()
+{
+	return new TableEngine;
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+
+. ./testlibrary.sh
+
+test_header "Sharding"
+
+do_this_test && {
+	(
+	cd t09 &&
+	run_test "sharded runtime" ./test1.sh 0 :
+	)
+}
+
+test_trailer
@@ -0,0 +1,193 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "cthsm_shard.hh"
+#include "../check.hh"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <stdint.h>
+
+using namespace CTHSM;
+
+
+class HopEvent : public Event {
+public:
+	HopEvent(int n) : Event(n), hops(0) { };
+	HopEvent(int n, unsigned hops) : Event(n), hops(hops) { };
+	enum {
+		EV_HOP = CTHE_USER,
+		EV_BYE,
+		EV_GONE,
+		EV_HELLO,
+	};
+	unsigned hops;
+};
+
+
+class Relay;
+typedef ShardedRuntime<Relay, HopEvent, 64, 8> Runtime;
+
+Runtime* runtime;
+
+const unsigned long KEYS = 1000;
+
+/** A key whose HSM sends to itself while it is being made. */
+const unsigned long SELF = KEYS;
+
+std::atomic<unsigned long> handled(0);
+std::atomic<unsigned long> created(0);
+std::atomic<unsigned long> destroyed(0);
+std::atomic<unsigned long> destroyedHops(0);
+std::atomic<unsigned long> wrongThread(0);
+std::atomic<unsigned long> misaligned(0);
+std::atomic<unsigned long> greeted(0);
+
+
+/**
+ * Passes each EV_HOP on to another key until it runs out of hops, and
+ * retires itself on EV_BYE.  Checks that it is only ever run and
+ * destroyed by the thread that created it.  Its exit action sends an
+ * EV_GONE, which nobody handles, so stopping the runtime sends one from
+ * every HSM.  The HSM for SELF sends itself an EV_HELLO from its
+ * constructor and from its entry action.
+ */
+class Relay : public CTHsm<Relay, HopEvent> {
+public:
+	Relay(unsigned long key) : CTHsm<Relay,HopEvent>(&Relay::relaying),
+				   key(key), hops(0),
+				   thread(std::this_thread::get_id())
+	{
+		created++;
+		// Machines are allocated on cache line boundaries.
+		if (reinterpret_cast<uintptr_t>(this) % CTHSM_CACHE_LINE)
+			misaligned++;
+		if (key == SELF)
+			runtime->send(key, HopEvent(HopEvent::EV_HELLO));
+		cthsmStart();
+	};
+
+	~Relay() {
+		if (std::this_thread::get_id() != thread)
+			wrongThread++;
+		destroyed++;
+		destroyedHops += hops;
+	};
+
+	CTHsmState relaying(HopEvent e) {
+		if (std::this_thread::get_id() != thread)
+			wrongThread++;
+		switch (e.event()) {
+		case HopEvent::CTHE_ENTRY:
+			if (key == SELF)
+				runtime->send(key,
+					      HopEvent(HopEvent::EV_HELLO));
+			return cth_handled();
+		case HopEvent::EV_HELLO:
+			greeted++;
+			return cth_handled();
+		case HopEvent::CTHE_EXIT:
+			runtime->send((key * 7 + 1) % KEYS,
+				      HopEvent(HopEvent::EV_GONE));
+			return cth_handled();
+		case HopEvent::EV_HOP:
+			hops++;
+			handled++;
+			if (e.hops) {
+				runtime->send((key * 7 + 1) % KEYS,
+					      HopEvent(HopEvent::EV_HOP,
+						       e.hops - 1));
+			}
+			return cth_handled();
+		case HopEvent::EV_BYE:
+			runtime->retire(key);
+			return cth_handled();
+		default:
+			return cth_parent(&Relay::topState);
+		}
+	};
+
+	unsigned long key;
+	unsigned long hops;
+	std::thread::id thread;
+};
+
+
+/**
+ * Wait up to ten seconds for counter to reach value.
+ */
+static bool waitFor(std::atomic<unsigned long>& counter, unsigned long value)
+{
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (counter.load() < value) {
+		if (std::chrono::steady_clock::now() > deadline) {
+			std::cerr << "timed out at " << counter.load()
+				  << " of " << value << "\n";
+			return false;
+		}
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+
+int main(int argc, char **argv)
+{
+	Runtime r(4);
+	runtime = &r;
+
+	// Keys spread over every shard.
+	unsigned counts[4] = { 0, 0, 0, 0 };
+	for (unsigned long k = 0; k < KEYS; k++)
+		counts[r.shardOf(k)]++;
+	for (unsigned i = 0; i < 4; i++)
+		CHECK( counts[i] > KEYS / 8 );
+
+	r.start();
+
+	// Each hop crosses shards most of the time, and the small channels
+	// fill up, so this tests both the local and the channel paths, and
+	// senders waiting on full channels.
+	const unsigned HOPS = 50;
+	for (unsigned long k = 0; k < KEYS; k++)
+		r.send(k, HopEvent(HopEvent::EV_HOP, HOPS));
+	r.flush();
+	CHECK( waitFor(handled, KEYS * (HOPS + 1)) );
+	CHECK( created.load() == KEYS );
+
+	// Retiring destroys the HSM, and the next event makes a new one.
+	r.send(3, HopEvent(HopEvent::EV_BYE));
+	r.flush();
+	CHECK( waitFor(destroyed, 1) );
+	r.send(3, HopEvent(HopEvent::EV_HOP, 0));
+	r.flush();
+	CHECK( waitFor(handled, KEYS * (HOPS + 1) + 1) );
+	CHECK( created.load() == KEYS + 1 );
+
+	// Events an HSM sends to its own key while it is being made are
+	// handled once it exists, and don't make more HSMs.
+	r.send(SELF, HopEvent(HopEvent::EV_GONE));
+	r.flush();
+	CHECK( waitFor(greeted, 2) );
+	CHECK( created.load() == KEYS + 2 );
+
+	// Stopping destroys every HSM, each on its own shard's thread.
+	r.stop();
+
+	CHECK( wrongThread.load() == 0 );
+	CHECK( misaligned.load() == 0 );
+	CHECK( greeted.load() == 2 );
+	CHECK( handled.load() == KEYS * (HOPS + 1) + 1 );
+	CHECK( destroyed.load() == created.load() );
+	CHECK( destroyedHops.load() == handled.load() );
+
+	return checkStatus();
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+
+. ./testlibrary.sh
+
+test_header "Table driven HSMs"
+
+do_this_test && {
+	(
+	cd t10 &&
+	run_test "tables from files" ./test1.sh 0 :
+	)
+}
+
+do_this_test && {
+	(
+	cd t10 &&
+	run_test "abort on an unloaded table" ./test2.sh 134 :
+	)
+}
+
+test_trailer
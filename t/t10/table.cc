@@ -0,0 +1,249 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "cthsm_table.hh"
+#include "../check.hh"
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace CTHSM;
+
+
+/*
+ *  top -+- a -+- a1
+ *       |     \- a2
+ *       \- b --- b1
+ */
+enum { TOP, A, A1, A2, B, B1 };
+const char* names[] = { "top", "a", "a1", "a2", "b", "b1" };
+
+enum { EV_GO_B1, EV_GO_A2, EV_SELF, EV_TOP, EV_PING, EV_PONG, EVENTS };
+
+enum { ACT_ENTRY, ACT_EXIT, ACT_HANDLE, ACT_TACT, ACT_PING };
+
+
+static void act(TableHsm& hsm, uint32_t id)
+{
+	std::string& trace = *static_cast<std::string*>(hsm.user());
+	const char* name = names[hsm.actionState()];
+	switch (id) {
+	case ACT_ENTRY:
+		trace += std::string("+") + name + " ";
+		break;
+	case ACT_EXIT:
+		trace += std::string("-") + name + " ";
+		break;
+	case ACT_PING:
+		hsm.post(EV_PONG);
+		// fall through
+	case ACT_HANDLE:
+		trace += std::string(name) + ":" + char('0' + hsm.event())
+			+ " ";
+		break;
+	case ACT_TACT:
+		trace += "! ";
+		break;
+	}
+}
+
+
+static void describe(TableBuilder& b)
+{
+	b.state(TABLE_NONE, ACT_ENTRY, ACT_EXIT);
+	b.state(TOP, ACT_ENTRY, ACT_EXIT);
+	b.state(A, ACT_ENTRY, ACT_EXIT);
+	b.state(A, ACT_ENTRY, ACT_EXIT);
+	b.state(TOP, ACT_ENTRY, ACT_EXIT);
+	b.state(B, ACT_ENTRY, ACT_EXIT);
+
+	b.transition(A, EV_GO_B1, B1, ACT_TACT, ACT_HANDLE);
+	b.transition(A1, EV_GO_A2, A2, ACT_TACT, ACT_HANDLE);
+	b.transition(B, EV_GO_A2, A2, ACT_TACT, ACT_HANDLE);
+	b.transition(B1, EV_SELF, B1, ACT_TACT, ACT_HANDLE);
+	b.transition(B1, EV_TOP, TOP, ACT_TACT, ACT_HANDLE);
+	b.transition(TOP, EV_GO_A2, A2, ACT_TACT, ACT_HANDLE);
+	b.handle(TOP, EV_PING, ACT_PING);
+	b.handle(TOP, EV_PONG, ACT_HANDLE);
+	b.initial(A1);
+}
+
+
+static void run(const StateTable& table, const TableActions& actions)
+{
+	std::string trace;
+	{
+		TableHsm hsm(table, actions, &trace);
+		hsm.start();
+		CHECK( trace == "+top +a +a1 " );
+		CHECK( hsm.state() == A1 );
+		CHECK( hsm.inState(A) && hsm.inState(TOP) );
+		CHECK( ! hsm.inState(B) );
+
+		// a1 -> a2: only a1 is exited, and the action is called
+		// between the exit and the entry.
+		trace = "";
+		hsm.sendEvent(EV_GO_A2);
+		CHECK( trace == "a1:1 -a1 ! +a2 " );
+
+		// Handled by a, so the path starts from the current state.
+		trace = "";
+		hsm.sendEvent(EV_GO_B1);
+		CHECK( trace == "a:0 -a2 -a ! +b +b1 " );
+
+		// Self transitions have no transition action.
+		trace = "";
+		hsm.sendEvent(EV_SELF);
+		CHECK( trace == "b1:2 -b1 +b1 " );
+
+		// Nothing between b1 and the top handles this.
+		trace = "";
+		hsm.sendEvent(EV_GO_B1);
+		CHECK( trace == "" );
+		CHECK( hsm.state() == B1 );
+
+		// Internal events are handled straight after the event that
+		// posted them.
+		trace = "";
+		hsm.sendEvent(EV_PING);
+		CHECK( trace == "top:4 top:5 " );
+
+		// Events that are not in the table are dropped, in every
+		// build.
+		trace = "";
+		CHECK( hsm.sendEvent(EVENTS) == false );
+		CHECK( trace == "" );
+		CHECK( hsm.state() == B1 );
+
+		// To the top state: everything is exited, including the top
+		// state, and there is no transition action.
+		trace = "";
+		hsm.sendEvent(EV_TOP);
+		CHECK( trace == "b1:3 -b1 -b -top " );
+		CHECK( hsm.state() == TOP );
+
+		// From the top state: everything is entered, including the
+		// top state, and there is no transition action.
+		trace = "";
+		hsm.sendEvent(EV_GO_A2);
+		CHECK( trace == "top:1 +top +a +a2 " );
+		trace = "";
+	}
+	CHECK( trace == "-a2 -a -top " );
+}
+
+
+/**
+ * Attach a changed copy of a table.
+ *
+ * \arg fix if true, put the checksum right after the change.
+ */
+static const char* attach(const std::string& bytes, unsigned offset,
+			  uint32_t value, bool fix)
+{
+	static std::vector<uint32_t> copy;
+	copy.assign(bytes.size() / 4, 0);
+	memcpy(&copy[0], bytes.data(), bytes.size());
+	copy[offset / 4] = value;
+	TableHeader* h = reinterpret_cast<TableHeader*>(&copy[0]);
+	if (fix) {
+		const unsigned char* body =
+			reinterpret_cast<const unsigned char*>(&copy[0])
+			+ sizeof(TableHeader);
+		h->checksum = tableChecksum(body,
+					    bytes.size() - sizeof(TableHeader));
+	}
+	StateTable table;
+	return table.attach(&copy[0], bytes.size());
+}
+
+
+// Copying a mapped table would unmap it twice.
+static_assert( ! std::is_copy_constructible<StateTable>::value,
+	       "StateTable must not be copyable" );
+static_assert( ! std::is_copy_assignable<StateTable>::value,
+	       "StateTable must not be copyable" );
+
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && 0 == strcmp(argv[1], "unloaded")) {
+		StateTable table;
+		TableActions none;
+		TableHsm hsm(table, none);
+		// Not reached.
+		return 0;
+	}
+
+	TableActions actions;
+	actions.bind(ACT_ENTRY, act);
+	actions.bind(ACT_EXIT, act);
+	actions.bind(ACT_HANDLE, act);
+	actions.bind(ACT_TACT, act);
+	actions.bind(ACT_PING, act);
+
+	TableBuilder builder(EVENTS);
+	describe(builder);
+	std::string bytes = builder.build();
+	std::vector<uint32_t> aligned(bytes.size() / 4);
+	memcpy(&aligned[0], bytes.data(), bytes.size());
+
+	StateTable table;
+	CHECK( table.attach(&aligned[0], bytes.size()) == 0 );
+	CHECK( table.nstates() == 6 );
+	CHECK( table.nevents() == EVENTS );
+	CHECK( table.nactions() == ACT_PING + 1 );
+	CHECK( actions.check(table) == 0 );
+	run(table, actions);
+
+	// The same table, written to a file and mapped.
+	{
+		StateTable loaded;
+		CHECK( loaded.load("no-such-table") != 0 );
+		CHECK( builder.write("table.bin") == 0 );
+		CHECK( loaded.load("table.bin") == 0 );
+		run(loaded, actions);
+	}
+
+	// Missing actions are found before anything runs.
+	TableActions some;
+	some.bind(ACT_ENTRY, act);
+	CHECK( some.check(table) != 0 );
+
+	// Broken tables are rejected.
+	std::string e;
+	const unsigned states = sizeof(TableHeader);
+	const unsigned b1 = states + B1 * sizeof(TableState);
+	e = attach(bytes, 0, 0x58585858, false);
+	CHECK( e == "not a table file" );
+	e = attach(bytes, offsetof(TableHeader, version), 2, false);
+	CHECK( e == "table has the wrong version" );
+	e = attach(bytes, offsetof(TableHeader, byteOrder), 0x04030201,
+		   false);
+	CHECK( e == "table has the wrong byte order" );
+	e = attach(bytes, offsetof(TableHeader, nstates), 7, false);
+	CHECK( e == "table counts do not match its size" );
+	e = attach(bytes, b1, A1, false);
+	CHECK( e == "table checksum is wrong" );
+	e = attach(bytes, b1, B1, true);
+	CHECK( e == "table state has a bad parent" );
+	e = attach(bytes, b1 + 4, ACT_PING + 1, true);
+	CHECK( e == "table state has a bad action" );
+	e = attach(bytes, offsetof(TableHeader, initial), 6, true);
+	CHECK( e == "table has a bad initial state" );
+	StateTable shorter;
+	e = shorter.attach(&aligned[0], bytes.size() - 4);
+	CHECK( e == "table has the wrong size" );
+	CHECK( ! shorter.loaded() );
+
+	return checkStatus();
+}
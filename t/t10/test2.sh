@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# A TableHsm made with a table that is not loaded must abort, in every
+# build.
+make table >/dev/null || exit 1
+./table unloaded 2>/dev/null
@@ -0,0 +1,14 @@
+#!/bin/sh
+
+. ./testlibrary.sh
+
+test_header "Bulk sends"
+
+do_this_test && {
+	(
+	cd t11 &&
+	run_test "bulk sends and fleets" ./test1.sh 0 :
+	)
+}
+
+test_trailer
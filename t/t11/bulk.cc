@@ -0,0 +1,272 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENCE" (Revision 42):
+ * <russells@adelie.cx> wrote this file. As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return. Russell Steicke.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "cthsm_fleet.hh"
+#include "../check.hh"
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace CTHSM;
+
+
+class FlipEvent : public Event {
+public:
+	FlipEvent(int n) : Event(n) { };
+	enum {
+		EV_FLIP = CTHE_USER,
+		EV_TOUCH,
+		EV_ALL,
+	};
+};
+
+
+class Node;
+
+/** The HSMs that EV_ALL sends an EV_FLIP to. */
+std::vector<Node*> all;
+
+/**
+ * What each HSM has done.  This is kept outside the HSMs because ~CTHsm()
+ * runs their exit actions after ~Node().
+ */
+std::map<const Node*, std::string> traces;
+
+/** Off while Fleet threads run the HSMs, since traces is not locked. */
+bool tracing = true;
+
+
+/**
+ *  top -+- on --- a
+ *       |
+ *       +- b
+ *       |
+ *       \- c
+ *
+ * EV_FLIP moves a to b, with a transition action, and b back to a.  c
+ * handles EV_FLIP without a transition.  Everything is recorded in traces.
+ */
+class Node : public CTHsm<Node, FlipEvent> {
+public:
+	Node(char start) : CTHsm<Node,FlipEvent>(initial(start)), flips(0)
+	{
+		cthsmRegister(&Node::a);
+		cthsmRegister(&Node::b);
+		cthsmRegister(&Node::c);
+		cthsmStart();
+	};
+
+	static State initial(char start) {
+		if (start == 'b')
+			return &Node::b;
+		if (start == 'c')
+			return &Node::c;
+		return &Node::a;
+	};
+
+	CTHsmState on(FlipEvent e) {
+		return step(e, "on", &Node::topState);
+	};
+
+	CTHsmState a(FlipEvent e) {
+		switch (e.event()) {
+		case FlipEvent::EV_FLIP:
+			flips++;
+			note("f ");
+			return cth_transition(&Node::b, &Node::flipped);
+		case FlipEvent::EV_ALL:
+			note("all ");
+			Node::cthsmBulkSend(&all[0], all.size(),
+					    FlipEvent(FlipEvent::EV_FLIP));
+			// We are busy, so our EV_FLIP waits until this event
+			// is done, but all[3], which also started in a, has
+			// had its EV_FLIP.
+			stillA = cthsmInState(&Node::a);
+			otherB = all[3]->cthsmInState(&Node::b);
+			return cth_handled();
+		}
+		return step(e, "a", &Node::on);
+	};
+
+	CTHsmState b(FlipEvent e) {
+		if (e.event() == FlipEvent::EV_FLIP) {
+			flips++;
+			note("f ");
+			return cth_transition(&Node::a);
+		}
+		return step(e, "b", &Node::topState);
+	};
+
+	CTHsmState c(FlipEvent e) {
+		if (e.event() == FlipEvent::EV_FLIP) {
+			flips++;
+			note("h ");
+			return cth_handled();
+		}
+		return step(e, "c", &Node::topState);
+	};
+
+	const std::string& trace() {
+		return traces[this];
+	};
+
+	unsigned flips;
+	bool stillA;
+	bool otherB;
+
+private:
+	CTHsmState step(FlipEvent e, const char* name, State parent) {
+		switch (e.event()) {
+		case FlipEvent::CTHE_ENTRY:
+			note(std::string("+") + name + " ");
+			return cth_handled();
+		case FlipEvent::CTHE_EXIT:
+			note(std::string("-") + name + " ");
+			return cth_handled();
+		case FlipEvent::EV_TOUCH:
+			note(std::string("t") + name + " ");
+			return cth_handled();
+		default:
+			return cth_parent(parent);
+		}
+	};
+
+	void note(const std::string& what) {
+		if (tracing)
+			traces[this] += what;
+	};
+
+	void flipped() {
+		note("! ");
+	};
+};
+
+
+/**
+ * Make n HSMs, starting in a, b and c in turn.
+ */
+static std::vector<Node*> make(unsigned n)
+{
+	std::vector<Node*> nodes;
+	for (unsigned i = 0; i < n; i++)
+		nodes.push_back(new Node("abc"[i % 3]));
+	return nodes;
+}
+
+
+static void destroy(std::vector<Node*>& nodes)
+{
+	for (unsigned i = 0; i < nodes.size(); i++)
+		delete nodes[i];
+	nodes.clear();
+	traces.clear();
+}
+
+
+/**
+ * \return true if every HSM in bulk has the same trace as the HSM in
+ * single at the same place.
+ */
+static bool sameTraces(const std::vector<Node*>& bulk,
+		       const std::vector<Node*>& single)
+{
+	for (unsigned i = 0; i < bulk.size(); i++) {
+		if (bulk[i]->trace() != single[i]->trace()) {
+			std::cerr << "HSM " << i << ": bulk \""
+				  << bulk[i]->trace() << "\", sendEvent() \""
+				  << single[i]->trace() << "\"\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/**
+ * Send EV_FLIP many times to a Fleet's worth of HSMs.
+ */
+static void flipMany(Fleet<Node, FlipEvent>* fleet, std::vector<Node*>* nodes,
+		     unsigned times)
+{
+	for (unsigned i = 0; i < times; i++)
+		fleet->sendEvent(*nodes, FlipEvent(FlipEvent::EV_FLIP));
+}
+
+
+int main(int argc, char **argv)
+{
+	// HSMs that transition and HSMs that only handle the event, in
+	// more than one block of cthsmBulkSend(), each see what they would
+	// see with sendEvent().
+	{
+		std::vector<Node*> bulk = make(1000);
+		std::vector<Node*> single = make(1000);
+		for (unsigned n = 0; n < 3; n++) {
+			Node::cthsmBulkSend(&bulk[0], bulk.size(),
+					    FlipEvent(FlipEvent::EV_FLIP));
+			for (unsigned i = 0; i < single.size(); i++)
+				single[i]->sendEvent(
+					FlipEvent(FlipEvent::EV_FLIP));
+		}
+		CHECK( sameTraces(bulk, single) );
+		CHECK( bulk[0]->trace() == "+on +a f -a -on ! +b f -b +on +a "
+		       "f -a -on ! +b " );
+		CHECK( bulk[2]->trace() == "+c h h h " );
+		destroy(bulk);
+		destroy(single);
+	}
+
+	// An HSM with queued events gets the event after them.
+	{
+		std::vector<Node*> bulk = make(3);
+		bulk[0]->cthsmQueueEvent(FlipEvent(FlipEvent::EV_TOUCH));
+		Node::cthsmBulkSend(&bulk[0], bulk.size(),
+				    FlipEvent(FlipEvent::EV_FLIP));
+		CHECK( bulk[0]->trace() == "+on +a ta f -a -on ! +b " );
+		CHECK( bulk[1]->trace() == "+b f -b +on +a " );
+		destroy(bulk);
+	}
+
+	// An HSM that sends in bulk from one of its own states gets its event
+	// when that state function is done.
+	{
+		all = make(6);
+		all[0]->sendEvent(FlipEvent(FlipEvent::EV_ALL));
+		CHECK( all[0]->stillA );
+		CHECK( all[0]->otherB );
+		CHECK( all[0]->trace() == "+on +a all f -a -on ! +b " );
+		CHECK( all[3]->trace() == "+on +a f -a -on ! +b " );
+		CHECK( all[2]->trace() == "+c h " );
+		destroy(all);
+	}
+
+	// Two threads sending with one Fleet take turns.
+	{
+		tracing = false;
+		Fleet<Node, FlipEvent> fleet(2, 4);
+		std::vector<Node*> one = make(60);
+		std::vector<Node*> two = make(60);
+		const unsigned TIMES = 200;
+		std::thread other(flipMany, &fleet, &two, TIMES);
+		flipMany(&fleet, &one, TIMES);
+		other.join();
+		for (unsigned i = 0; i < one.size(); i++) {
+			CHECK( one[i]->flips == TIMES );
+			CHECK( two[i]->flips == TIMES );
+		}
+		CHECK( one[0]->cthsmInState(&Node::a) );
+		CHECK( two[1]->cthsmInState(&Node::b) );
+		destroy(one);
+		destroy(two);
+	}
+
+	return checkStatus();
+}